@@ -0,0 +1,110 @@
+
+/* deterministic inputs for the benchmarks, written to stdout:
+ *
+ *   gen zipf <lines> <vocabulary> <exponent> <seed>
+ *       text for wordcount, 12 words a line drawn from a zipf law
+ *   gen clusters <points> <clusters> <dimension> <sigma> <seed>
+ *       points for kmeans, gaussian around centers in the unit cube
+ *   gen join <rows> <keys> <seed>
+ *       "key side value" rows for the join, side being L or R
+ *
+ * only mt19937_64 is taken from <random>, since its output is fixed by
+ * the standard while the distributions differ between libraries.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+static mt19937_64 rng;
+
+static double uniform() {
+	return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian() {
+	double u = uniform(), v = uniform();
+	return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+}
+
+static void word(size_t rank, char *buf) {
+	static const char letters[] = "etaoinshrdlucmfwypvbgkjqxz";
+	size_t n = 0;
+	do {
+		buf[n++] = letters[rank % 26];
+		rank /= 26;
+	} while ( rank > 0 );
+	buf[n] = '\0';
+}
+
+static int zipf(size_t lines, size_t vocabulary, double exponent) {
+	vector<double> cdf(vocabulary);
+	double sum = 0;
+	for (size_t i = 0; i < vocabulary; ++i) {
+		sum += 1.0 / pow((double)(i + 1), exponent);
+		cdf[i] = sum;
+	}
+
+	char buf[32];
+	for (size_t l = 0; l < lines; ++l) {
+		for (int w = 0; w < 12; ++w) {
+			double x = uniform() * sum;
+			size_t rank = lower_bound(cdf.begin(), cdf.end(), x) - cdf.begin();
+			word(min(rank, vocabulary - 1), buf);
+			printf(w ? " %s" : "%s", buf);
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+static int clusters(size_t points, size_t k, size_t dim, double sigma) {
+	vector<double> centers(k * dim);
+	for (double &c : centers) {
+		c = uniform();
+	}
+	for (size_t p = 0; p < points; ++p) {
+		size_t c = rng() % k;
+		for (size_t d = 0; d < dim; ++d) {
+			printf(d ? " %.6f" : "%.6f", centers[c * dim + d] + sigma * gaussian());
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+static int join(size_t rows, size_t keys) {
+	for (size_t r = 0; r < rows; ++r) {
+		unsigned long long key = rng() % keys;
+		printf("k%llu %c %llu\n", key, rng() & 1 ? 'R' : 'L',
+				(unsigned long long)(rng() % 1000000));
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if ( argc == 6 && strcmp(argv[1], "zipf") == 0 ) {
+		rng.seed(strtoull(argv[5], nullptr, 10));
+		return zipf(strtoull(argv[2], nullptr, 10), strtoull(argv[3], nullptr, 10),
+				atof(argv[4]));
+	}
+	if ( argc == 7 && strcmp(argv[1], "clusters") == 0 ) {
+		rng.seed(strtoull(argv[6], nullptr, 10));
+		return clusters(strtoull(argv[2], nullptr, 10), strtoull(argv[3], nullptr, 10),
+				strtoull(argv[4], nullptr, 10), atof(argv[5]));
+	}
+	if ( argc == 5 && strcmp(argv[1], "join") == 0 ) {
+		rng.seed(strtoull(argv[4], nullptr, 10));
+		return join(strtoull(argv[2], nullptr, 10), strtoull(argv[3], nullptr, 10));
+	}
+	fprintf(stderr, "usage: gen zipf <lines> <vocabulary> <exponent> <seed>\n"
+			"       gen clusters <points> <clusters> <dimension> <sigma> <seed>\n"
+			"       gen join <rows> <keys> <seed>\n");
+	return 1;
+}
@@ -0,0 +1,193 @@
+
+/* the jobs the benchmark runner times:
+ *
+ *   jobs wordcount <text> [profile]
+ *   jobs widecount <text> [profile]     wordcount, on text of many more words
+ *   jobs kmeans <points> [profile]      5 rounds, 8 centers, any dimension
+ *   jobs join <rows> [profile]
+ *
+ * a job name may be followed by options, each after a dash, to time the
+ * job with a config knob set:
+ *
+ *   arena      conf.arena, the grouping tables in an arena
+ *   sort       conf.group = grouping::sort
+ *
+ * so that wordcount-arena is wordcount with the arena on. prints the
+ * seconds the job took on the master; with a profile file, the per-phase
+ * job profiles are appended to it.
+ */
+
+#include "ares.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace ares;
+using namespace std;
+
+typedef collection<double> point_t;
+
+struct word_count {
+	void map(const string &input, collection2<string, uint64_t> &result) {
+		for (string &part : helper::split(input)) {
+			result.emplace_back(std::move(part), 1);
+		}
+	}
+
+	// keys are taken as views of the shuffled data
+	pair<string, uint64_t> reduce(string_view key, const collection<uint64_t> &values) {
+		uint64_t count = 0;
+		for (uint64_t value : values) {
+			count += value;
+		}
+		return make_pair(key.str(), count);
+	}
+
+	pair<string, uint64_t> combine(string_view key, const collection<uint64_t> &values) {
+		return reduce(key, values);
+	}
+};
+
+// map output is the sum of the points assigned to a center and their count
+typedef pair<point_t, uint64_t> sum_t;
+
+struct kmeans_map {
+	collection<point_t> centers;
+
+	void setup(collection<point_t> &&centers) {
+		this->centers = std::move(centers);
+	}
+
+	void map(const point_t &point, collection2<int, sum_t> &result) {
+		int best = 0;
+		double best_dist = -1;
+		for (size_t k = 0; k < centers.size(); ++k) {
+			double dist = 0;
+			for (size_t d = 0; d < point.size(); ++d) {
+				double x = point[d] - centers[k][d];
+				dist += x * x;
+			}
+			if ( best_dist < 0 || dist < best_dist ) {
+				best = (int)k;
+				best_dist = dist;
+			}
+		}
+		result.emplace_back(best, make_pair(point, (uint64_t)1));
+	}
+};
+
+struct kmeans_reduce {
+	pair<int, sum_t> combine(int key, const collection<sum_t> &values) {
+		sum_t sum(point_t(values[0].first.size(), 0.0), 0);
+		for (const sum_t &value : values) {
+			for (size_t d = 0; d < value.first.size(); ++d) {
+				sum.first[d] += value.first[d];
+			}
+			sum.second += value.second;
+		}
+		return make_pair(key, std::move(sum));
+	}
+
+	point_t reduce(int key, const collection<sum_t> &values) {
+		sum_t sum = combine(key, values).second;
+		for (double &x : sum.first) {
+			x /= sum.second;
+		}
+		return std::move(sum.first);
+	}
+};
+
+// equi-join on a high cardinality key, returns the joined row count per key
+struct join {
+	void map(const string &input, collection2<string, pair<char, uint64_t>> &result) {
+		collection<string> parts = helper::split(input);
+		if ( parts.size() == 3 ) {
+			result.emplace_back(std::move(parts[0]),
+					make_pair(parts[1][0], (uint64_t)strtoull(parts[2].c_str(), nullptr, 10)));
+		}
+	}
+
+	pair<string, uint64_t> reduce(const string &key, const collection<pair<char, uint64_t>> &values) {
+		uint64_t left = 0;
+		for (const pair<char, uint64_t> &value : values) {
+			left += value.first == 'L';
+		}
+		return make_pair(key, left * (values.size() - left));
+	}
+};
+
+static collection<point_t> read_points(const char *name) {
+	collection<point_t> points;
+	ifstream file(name);
+	string line;
+	while ( getline(file, line) ) {
+		istringstream in(line);
+		point_t point;
+		double x;
+		while ( in >> x ) {
+			point.push_back(x);
+		}
+		if ( !point.empty() ) {
+			points.push_back(std::move(point));
+		}
+	}
+	return points;
+}
+
+int main(int argc, char **argv) {
+	initialize<word_count, kmeans_map, kmeans_reduce, join>();
+
+	if ( argc < 3 ) {
+		fprintf(stderr, "usage: jobs <wordcount|widecount|kmeans|join>[-option...] <input> [profile]\n");
+		return 1;
+	}
+	config conf = get_config();
+	conf.profile = argc > 3;
+	collection<string> options = helper::split(argv[1]);
+	string name = options[0];
+	for (size_t i = 1; i < options.size(); ++i) {
+		if ( options[i] == "arena" ) {
+			conf.arena = true;
+		} else if ( options[i] == "sort" ) {
+			conf.group = grouping::sort;
+		} else {
+			fprintf(stderr, "unknown option %s\n", options[i].c_str());
+			return 1;
+		}
+	}
+	set_config(conf);
+	if ( argc > 3 ) {
+		set_profile_output(argv[3]);
+	}
+
+	// points are parsed before the clock starts
+	collection<point_t> points;
+	if ( name == "kmeans" ) {
+		points = read_points(argv[2]);
+	}
+	auto start = chrono::steady_clock::now();
+
+	if ( name == "wordcount" || name == "widecount" ) {
+		scatter_map_file(argv[2]);
+		run_without_scatter<word_count>();
+	} else if ( name == "kmeans" ) {
+		collection<point_t> centers(points.begin(), points.begin() + min<size_t>(8, points.size()));
+		scatter_map_data(points);
+		set_map_side_data(centers);
+		iterate<kmeans_map, kmeans_reduce>(5, [](const collection<point_t> &, const collection<point_t> &) {
+			return false;
+		});
+	} else if ( name == "join" ) {
+		scatter_map_file(argv[2]);
+		run_without_scatter<join, join, void>();
+	} else {
+		fprintf(stderr, "unknown job %s\n", name.c_str());
+		return 1;
+	}
+
+	chrono::duration<double> d = chrono::steady_clock::now() - start;
+	printf("seconds=%.6f\n", d.count());
+	return 0;
+}
@@ -0,0 +1,185 @@
+
+/* microbenchmarks of the pieces every job is built on:
+ *
+ *   micro serialize [records]    byte_array write and read of a collection
+ *                                of each record type, on the master alone
+ *   micro mpi [max bytes]        each mpi_controller collective, with 64
+ *                                bytes up to max bytes (default 4 MiB) per rank
+ *
+ * results go to stdout of the master as tab separated rows:
+ *
+ *   serialize  type  op  records  bytes  ns/record  MB/s
+ *   mpi        op    ranks  bytes per rank  us/op  MB/s
+ *
+ * MB/s counts the serialized bytes, and for a collective all the bytes it
+ * delivers; times are the best of several runs, the slowest rank for mpi.
+ */
+
+#include "bytes.hpp"
+#include "mpi.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+using namespace ares_impl;
+using namespace std;
+
+// a user type with its own write_to, as nc_int in the wordcount example;
+// its default constructor keeps it from being trivial, and so copied as
+// raw bytes without write_to
+class nc_int {
+public:
+	int v;
+	nc_int(): v(0) {}
+	nc_int(int v): v(v) {}
+
+	nc_int(const nc_int &) = delete;
+	nc_int &operator=(const nc_int &) = delete;
+
+	nc_int(nc_int &&) = default;
+	nc_int &operator=(nc_int &&) = default;
+
+	nc_int(byte_array &bs): v(bs.read<int>()) {}
+	void write_to(byte_array &bs) const { bs.write(v); }
+};
+
+static_assert(serialize_type_of<nc_int>::value == serialize_type::serializable,
+		"nc_int must go through write_to");
+
+static double now() {
+	chrono::duration<double> d = chrono::steady_clock::now().time_since_epoch();
+	return d.count();
+}
+
+// best seconds of one call to f, over at least 5 runs and 0.2 seconds
+static double best_of(const function<void()> &f) {
+	double best = 1e30, spent = 0;
+	for (int i = 0; i < 5 || spent < 0.2; ++i) {
+		double start = now();
+		f();
+		double t = now() - start;
+		best = min(best, t);
+		spent += t;
+	}
+	return best;
+}
+
+template <typename T> static void time_serialize(const char *type, collection<T> &records) {
+	byte_array bs;
+	double w = best_of([&] {
+		bs.clear();
+		bs.write(records);
+	});
+	double r = best_of([&] {
+		bs.reset();
+		collection<T> back = bs.read<collection<T>>();
+	});
+
+	size_t n = records.size(), bytes = bs.size();
+	printf("serialize\t%s\twrite\t%zu\t%zu\t%.2f\t%.1f\n", type, n, bytes, w * 1e9 / n, bytes / w / 1e6);
+	printf("serialize\t%s\tread\t%zu\t%zu\t%.2f\t%.1f\n", type, n, bytes, r * 1e9 / n, bytes / r / 1e6);
+}
+
+static void serialize_all(size_t n) {
+	collection<string> words(n);
+	collection<pair<int, double>> pairs(n);
+	collection<collection<int>> nested(n / 16);
+	collection<nc_int> user;
+	collection<pair<string, uint64_t>> counts(n);
+	for (size_t i = 0; i < n; ++i) {
+		words[i] = "word" + to_string(i % 10007);
+		pairs[i] = make_pair((int)i, i * 0.5);
+		user.emplace_back((int)i);
+		counts[i] = make_pair(words[i], i);
+	}
+	for (size_t i = 0; i < nested.size(); ++i) {
+		nested[i].assign(16, (int)i);
+	}
+
+	time_serialize("string", words);
+	time_serialize("pair<int,double>", pairs);
+	time_serialize("collection<int>[16]", nested);
+	time_serialize("nc_int", user);
+	time_serialize("pair<string,uint64>", counts);
+}
+
+// best seconds of op over the ranks, which start together
+static double best_collective(const function<void()> &op) {
+	double best = 1e30;
+	op();
+	for (int i = 0; i < 5; ++i) {
+		MPI_Barrier(MPI_COMM_WORLD);
+		double start = now();
+		op();
+		double t = now() - start, slowest;
+		MPI_Allreduce(&t, &slowest, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+		best = min(best, slowest);
+	}
+	return best;
+}
+
+static void collectives(mpi_controller &mpi, size_t max_bytes) {
+	size_t size = mpi.size();
+	for (size_t len = 64; len <= max_bytes; len *= 4) {
+		byte_array one, all, recv;
+		memset(one.grow(len), 1, len);
+		memset(all.grow(len * size), 2, len * size);
+		collection<size_t> counts(size, len);
+		collection<byte_array> views(size);
+
+		auto report = [&](const char *op, double t, size_t delivered) {
+			if ( mpi.is_m() ) {
+				printf("mpi\t%s\t%zu\t%zu\t%.2f\t%.1f\n", op, size, len, t * 1e6, delivered / t / 1e6);
+			}
+		};
+
+		report("bcast", best_collective([&] {
+			recv.clear();
+			mpi.bcast(mpi.is_m() ? one : recv, len);
+		}), len * (size - 1));
+
+		report("scatter", best_collective([&] {
+			recv.clear();
+			mpi.scatter(all, mpi.is_m() ? counts.data() : nullptr, recv);
+		}), len * size);
+
+		report("alltoall", best_collective([&] {
+			recv.clear();
+			mpi.alltoall(all, counts.data(), recv, views.data());
+		}), len * size * size);
+
+		report("gather", best_collective([&] {
+			recv.clear();
+			mpi.gather(one, recv, views.data());
+		}), len * size);
+
+		report("allgather", best_collective([&] {
+			recv.clear();
+			mpi.allgather(one, recv);
+		}), len * size * size);
+	}
+}
+
+int main(int argc, char **argv) {
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	{
+		mpi_controller mpi;
+		string what = argc > 1 ? argv[1] : "";
+		if ( what == "serialize" ) {
+			if ( mpi.is_m() ) {
+				serialize_all(argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000);
+			}
+		} else if ( what == "mpi" ) {
+			collectives(mpi, argc > 2 ? strtoull(argv[2], nullptr, 10) : 4 << 20);
+		} else if ( mpi.is_m() ) {
+			fprintf(stderr, "usage: micro serialize [records] | micro mpi [max bytes]\n");
+		}
+	}
+	MPI_Finalize();
+	return 0;
+}
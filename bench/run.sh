@@ -0,0 +1,141 @@
+#!/bin/bash
+#
+# strong and weak scaling sweeps of the benchmark jobs on one machine.
+#
+#   bench/run.sh [-n max_ranks] [-s scale] [-r repeat] [-t tolerance] [-o out] [--save]
+#
+# every job runs with 1..max_ranks ranks, on a fixed input (strong) and on
+# an input growing with the ranks (weak). the best of `repeat` runs is kept
+# and written as a row of tab separated values: throughput in records per
+# second, then the seconds of each phase (the slowest rank, summed over the
+# jobs of the run) from the job profiles. wordcount and join also run with
+# the arena on, and wordcount and widecount, a wordcount on text of many
+# more distinct words, with sort grouping, as rows of their own.
+#
+# the rows are compared to bench/baseline.tsv; a throughput more than
+# tolerance percent below its baseline is a regression and fails the run.
+# --save makes the results the new baseline.
+#
+# inputs are generated once into $BENCH_DATA (default /tmp/ares-bench);
+# mpirun is taken from $MPIRUN (default "mpirun --oversubscribe").
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+max_np=4
+scale=1
+repeat=3
+tolerance=10
+out=
+save=0
+
+while [ $# -gt 0 ]; do
+	case "$1" in
+	-n) max_np=$2; shift ;;
+	-s) scale=$2; shift ;;
+	-r) repeat=$2; shift ;;
+	-t) tolerance=$2; shift ;;
+	-o) out=$2; shift ;;
+	--save) save=1 ;;
+	*) echo "unknown option $1" >&2; exit 2 ;;
+	esac
+	shift
+done
+
+data=${BENCH_DATA:-/tmp/ares-bench}
+mpirun=${MPIRUN:-mpirun --oversubscribe}
+baseline=$root/bench/baseline.tsv
+out=${out:-$data/results.tsv}
+phases="scatter map combine serialize alltoall group reduce gather"
+
+mkdir -p "$data"
+
+# input <job> <records>: prints the path of the job's input, made on demand;
+# a job with options (see bench/jobs.cpp) shares the input of the plain one
+input() {
+	local job=${1%%-*}
+	local file=$data/$job-$2.txt
+	if [ ! -f "$file" ]; then
+		case "$job" in
+		wordcount) "$root/bench/gen" zipf "$2" 50000 1.1 7 ;;
+		widecount) "$root/bench/gen" zipf "$2" 2000000 0.5 7 ;;
+		kmeans) "$root/bench/gen" clusters "$2" 8 "${BENCH_DIM:-4}" 0.05 7 ;;
+		join) "$root/bench/gen" join "$2" $(($2 / 2)) 7 ;;
+		esac > "$file.tmp"
+		mv "$file.tmp" "$file"
+	fi
+	echo "$file"
+}
+
+# sums the max seconds of every phase over the lines of a profile
+phase_times() {
+	awk -v names="$phases" '{
+		n = split(names, a, " ")
+		for (i = 1; i <= n; ++i) {
+			if (match($0, "\"" a[i] "\":\\{\"min\":[^,]*,\"max\":[^,}]*")) {
+				s = substr($0, RSTART, RLENGTH)
+				sub(/.*"max":/, "", s)
+				t[i] += s
+			}
+		}
+	} END {
+		for (i = 1; i <= n; ++i) {
+			printf "%s%.4f", (i > 1 ? "\t" : ""), t[i]
+		}
+		print ""
+	}' "$1"
+}
+
+header="job	mode	ranks	records	seconds	records/s	$(echo $phases | tr ' ' '\t')"
+echo "$header" > "$out"
+
+for job in wordcount wordcount-arena wordcount-sort widecount widecount-sort \
+		kmeans join join-arena; do
+	base=$((100000 * scale))
+	for mode in strong weak; do
+		for np in $(seq 1 "$max_np"); do
+			records=$base
+			if [ $mode = weak ]; then
+				records=$((base * np))
+			fi
+			file=$(input $job $records)
+
+			best=
+			for r in $(seq 1 "$repeat"); do
+				rm -f "$data/profile.json"
+				secs=$($mpirun -np $np "$root/bench/jobs" $job "$file" "$data/profile.json" \
+						| sed -n 's/^seconds=//p')
+				if [ -z "$best" ] || awk "BEGIN { exit !($secs < $best) }"; then
+					best=$secs
+					times=$(phase_times "$data/profile.json")
+				fi
+			done
+
+			rate=$(awk "BEGIN { printf \"%.0f\", $records / $best }")
+			printf "%s\t%s\t%d\t%d\t%s\t%s\t%s\n" $job $mode $np $records $best $rate "$times" \
+					| tee -a "$out"
+		done
+	done
+done
+
+if [ $save = 1 ]; then
+	cp "$out" "$baseline"
+	echo "saved baseline $baseline"
+	exit 0
+fi
+if [ ! -f "$baseline" ]; then
+	echo "no baseline to compare with, see --save"
+	exit 0
+fi
+
+# rows are matched on job, mode and ranks
+awk -F '\t' -v tol="$tolerance" '
+	NR == FNR { if (FNR > 1) base[$1 " " $2 " " $3] = $6; next }
+	FNR > 1 && ($1 " " $2 " " $3) in base {
+		b = base[$1 " " $2 " " $3]
+		change = b > 0 ? ($6 - b) * 100 / b : 0
+		status = change < -tol ? "REGRESSION" : "ok"
+		printf "%-16s %-6s %2d ranks  %10d -> %10d records/s  %+6.1f%%  %s\n", $1, $2, $3, b, $6, change, status
+		if (status != "ok") failed = 1
+	}
+	END { exit failed }' "$baseline" "$out"
@@ -0,0 +1,60 @@
+#include "ares.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+using namespace ares;
+using namespace std;
+
+/* pushes a shuffle larger than 2 GiB through do_reduce, which needs the
+ * chunked paths of mpi_controller even on a single rank:
+ *   ./bigshuffle [MiB, default 2560]
+ * build with -DARES_MAX_COUNT=<small> to run the same paths on less data
+ */
+
+struct blob_map {
+	size_t blob = 0;
+
+	void setup(size_t bytes) {
+		blob = bytes;
+	}
+
+	void map(const int &part, collection2<int, string> &result) {
+		result.emplace_back(part, string(blob, 'a' + part % 26));
+	}
+};
+
+// reduce has no setup, so it needs no reduce side data
+struct blob_reduce {
+	size_t reduce(int key, const collection<string> &values) {
+		size_t total = 0;
+		for (const string &value : values) {
+			total += count(value.begin(), value.end(), 'a' + key % 26);
+		}
+		return total;
+	}
+};
+
+int main(int argc, char **argv) {
+	initialize<blob_map, blob_reduce>();
+
+	size_t mib = argc > 1 ? atol(argv[1]) : 2560;
+	size_t blob = min<size_t>(64, max<size_t>(1, mib / 16)) << 20;
+	size_t n = (mib << 20) / blob;
+
+	collection<int> input;
+	for (size_t k = 0; k < n; ++k) {
+		input.push_back((int)k);
+	}
+
+	set_map_side_data(blob);
+	collection<size_t> result = run_job<blob_map, blob_reduce, void>(input);
+
+	size_t total = 0;
+	for (size_t r : result) {
+		total += r;
+	}
+	printf("shuffled %zu bytes in %zu values: %s\n", n * blob, n,
+			total == n * blob ? "ok" : "mismatch");
+	return total == n * blob ? 0 : 1;
+}
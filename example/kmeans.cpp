@@ -75,17 +75,21 @@ int main(int argc, char **argv) {
 
 	scatter_map_data(std::move(input));
 
-	for (int k = 0; k < 5; k++) {
-		set_map_side_data(result);
-		result = run_without_scatter<kmeans_map, kmeans_reduce>();
-
-		printf("iteration %d finish\n", k);
-		sort(result.begin(), result.end());
+	set_map_side_data(result);
+
+	int iteration = 0;
+	auto report = [&](const collection<pair<double, double>> &,
+			const collection<pair<double, double>> &curr) {
+		collection<pair<double, double>> centers = curr;
+		printf("iteration %d finish\n", iteration++);
+		sort(centers.begin(), centers.end());
 		for (int s = 0; s < K; s++) {
-			printf("%.3f %.3f\n", result[s].first, result[s].second);
+			printf("%.3f %.3f\n", centers[s].first, centers[s].second);
 		}
 		printf("--------------\n");
-	}
+		return false;
+	};
+	result = iterate<kmeans_map, kmeans_reduce>(5, report);
 	return 0;
 }
 
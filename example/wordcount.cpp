@@ -61,12 +61,12 @@ struct word_count {
 
 int main(int argc, char **argv) {
 	initialize<word_count>();
-	collection<string> input = helper::readfile(argv[1]);
+	scatter_map_file(argv[1]);
 	if (argc == 2) {
 		printf("without combine\n");
-		collection2<string, int_t> result1 = run_job<word_count, word_count, void>(input);
+		collection2<string, int_t> result1 = run_without_scatter<word_count, word_count, void>();
 	} else {
-		collection2<string, int_t> result2 = run_job<word_count>(input);
+		collection2<string, int_t> result2 = run_without_scatter<word_count>();
 	}
 	return 0;
 }
@@ -0,0 +1,133 @@
+
+#ifndef _ARES_ARENA_HPP_
+#define _ARES_ARENA_HPP_
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <unordered_map>
+
+namespace ares_impl {
+
+	/* a bump allocator for the short lived tables of a job: memory is
+	 * carved out of large blocks and never given back one piece at a
+	 * time, only all at once by release(). this turns the one malloc and
+	 * free per key of a hash table into a pointer bump.
+	 *
+	 * not thread safe, every thread needs an arena of its own.
+	 */
+	class arena {
+		static constexpr size_t BLOCK = 256 << 10;
+
+		collection<void *> blocks;
+		uintptr_t cur = 0;
+		size_t left = 0;
+		size_t held = 0;
+
+	public:
+		arena() = default;
+		arena(const arena &) = delete;
+		arena &operator=(const arena &) = delete;
+
+		~arena() { release(); }
+
+		void *allocate(size_t bytes, size_t align) {
+			size_t pad = (align - cur % align) % align;
+			if ( pad + bytes > left ) {
+				// big pieces get a block of their own, keeping the current one
+				if ( bytes + align > BLOCK / 4 ) {
+					return (void *)aligned(block(bytes + align), align);
+				}
+				cur = (uintptr_t)block(BLOCK);
+				left = BLOCK;
+				pad = (align - cur % align) % align;
+			}
+			void *p = (void *)(cur + pad);
+			cur += pad + bytes;
+			left -= pad + bytes;
+			return p;
+		}
+
+		// frees everything allocated so far
+		void release() {
+			for (void *b : blocks) {
+				free(b);
+			}
+			blocks.clear();
+			cur = 0;
+			left = 0;
+			held = 0;
+		}
+
+		// bytes of the blocks held
+		size_t size() const { return held; }
+
+	private:
+		void *block(size_t bytes) {
+			void *b = malloc(bytes);
+			if ( b == nullptr ) {
+				throw std::bad_alloc();
+			}
+			blocks.push_back(b);
+			held += bytes;
+			return b;
+		}
+
+		static uintptr_t aligned(void *p, size_t align) {
+			uintptr_t u = (uintptr_t)p;
+			return u + (align - u % align) % align;
+		}
+	};
+
+	/* a standard allocator taking from an arena, or from the heap when it
+	 * has none, so the same container type serves both modes
+	 */
+	template <typename T> struct arena_allocator {
+		typedef T value_type;
+
+		arena *pool;
+
+		arena_allocator(arena *pool = nullptr): pool(pool) {}
+		template <typename U> arena_allocator(const arena_allocator<U> &o): pool(o.pool) {}
+
+		T *allocate(size_t n) {
+			if ( pool != nullptr ) {
+				return (T *)pool->allocate(n * sizeof(T), alignof(T));
+			}
+			return std::allocator<T>().allocate(n);
+		}
+
+		void deallocate(T *p, size_t n) {
+			if ( pool == nullptr ) {
+				std::allocator<T>().deallocate(p, n);
+			}
+		}
+
+		template <typename U> bool operator==(const arena_allocator<U> &o) const {
+			return pool == o.pool;
+		}
+		template <typename U> bool operator!=(const arena_allocator<U> &o) const {
+			return pool != o.pool;
+		}
+	};
+
+	/* the hash table of the grouping and combine steps, K to collection<V>.
+	 * only its nodes and buckets come from the arena: the keys and value
+	 * collections are what reduce and combine are called with, so they
+	 * keep the standard allocator
+	 */
+	template <typename K, typename V> using group_map = std::unordered_map<
+			K, collection<V>, std::hash<K>, std::equal_to<K>,
+			arena_allocator<pair<const K, collection<V>>>>;
+
+	template <typename K, typename V> group_map<K, V> make_group_map(arena *pool) {
+		typedef arena_allocator<pair<const K, collection<V>>> alloc_t;
+		return group_map<K, V>(0, std::hash<K>(), std::equal_to<K>(), alloc_t(pool));
+	}
+
+}
+
+#endif // _ARES_ARENA_HPP_
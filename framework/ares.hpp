@@ -10,6 +10,14 @@ namespace ares {
 	using ares_impl::byte_array;
 	using ares_impl::collection;
 	using ares_impl::collection2;
+	using ares_impl::config;
+	using ares_impl::grouping;
+	using ares_impl::result_format;
+	using ares_impl::result_manifest;
+	using ares_impl::result_part;
+	using ares_impl::result_stream;
+	using ares_impl::span;
+	using ares_impl::string_view;
 
 	using namespace ares_impl::work_flow_api;
 
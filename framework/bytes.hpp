@@ -4,7 +4,9 @@
 
 #include "types.hpp"
 
+#include <cstring>
 #include <string>
+#include <tuple>
 
 namespace ares_impl {
 
@@ -15,10 +17,34 @@ namespace ares_impl {
 		trivial, serializable, unknow
 	};
 
+	/* copied as raw bytes: trivial types, and pairs / tuples of them
+	 * without padding, whose indeterminate bytes would otherwise go on the
+	 * wire and make equal values compare unequal as bytes
+	 */
+	template <typename T> struct is_bulk: std::is_trivial<T> {};
+
+	template <typename ... Ts> struct all_bulk: std::true_type {};
+	template <typename T, typename ... Ts> struct all_bulk<T, Ts...>:
+			std::integral_constant<bool,
+			is_bulk<T>::value && all_bulk<Ts...>::value> {};
+
+	template <typename ... Ts> struct packed_size: std::integral_constant<size_t, 0> {};
+	template <typename T, typename ... Ts> struct packed_size<T, Ts...>:
+			std::integral_constant<size_t, sizeof(T) + packed_size<Ts...>::value> {};
+
+	template <typename T, typename ... Ts> using bulk_of =
+			std::integral_constant<bool,
+			all_bulk<Ts...>::value && sizeof(T) == packed_size<Ts...>::value>;
+
+	template <typename K, typename V> struct is_bulk<pair<K, V>>: bulk_of<pair<K, V>, K, V> {};
+	template <> struct is_bulk<string_view>: std::false_type {};
+	template <typename T> struct is_bulk<span<T>>: std::false_type {};
+	template <typename ... Ts> struct is_bulk<std::tuple<Ts...>>: bulk_of<std::tuple<Ts...>, Ts...> {};
+
 	template <typename T> using serialize_type_of =
 			std::integral_constant<
 			serialize_type,
-			std::is_trivial<T>::value ?
+			is_bulk<T>::value ?
 			serialize_type::trivial :
 			std::is_constructible<T, byte_array &>::value &&
 			has_write_to<T>::value &&
@@ -31,17 +57,23 @@ namespace ares_impl {
 	template <typename T> using serialize =
 			do_serialize<T, serialize_type_of<T>::value>;
 
+	/* either owns its bytes, or is a read-only view over memory owned by
+	 * another byte_array (see view()), which must outlive the view
+	 */
 	class byte_array {
 	private:
 		std::vector<byte> _bytes;
+		const byte *_view = nullptr;
+		size_t _view_size = 0;
 		size_t _offset = 0;
 
 	public:
 		byte_array() = default;
 		byte_array(byte_array &&) = default;
+		byte_array &operator=(byte_array &&) = default;
 
 		const byte *read(size_t size) {
-			byte *p = _bytes.data() + _offset;
+			const byte *p = data() + _offset;
 			_offset += size;
 			return p;
 		}
@@ -58,9 +90,33 @@ namespace ares_impl {
 			serialize<T>::write(v, *this);
 		}
 
-		const byte *data() const { return _bytes.data(); }
+		const byte *data() const { return _view ? _view : _bytes.data(); }
+
+		size_t size() const { return _view ? _view_size : _bytes.size(); }
 
-		size_t size() const { return _bytes.size(); }
+		size_t remain() const { return size() - _offset; }
+
+		bool is_view() const { return _view != nullptr; }
+
+		// a view of size bytes from offset, with its own read position
+		byte_array view(size_t offset, size_t size) const {
+			byte_array v;
+			v._view = data() + offset;
+			v._view_size = size;
+			return v;
+		}
+
+		byte_array view() const { return view(0, size()); }
+
+		// appends len uninitialized bytes and returns where they start
+		byte *grow(size_t len) {
+			size_t s = _bytes.size();
+			_bytes.resize(s + len);
+			return _bytes.data() + s;
+		}
+
+		// drops the bytes past the first len
+		void truncate(size_t len) { _bytes.resize(len); }
 
 		byte *reserve(size_t inc) {
 			size_t s = _bytes.size();
@@ -72,6 +128,8 @@ namespace ares_impl {
 
 		void clear() {
 			_bytes.clear();
+			_view = nullptr;
+			_view_size = 0;
 			reset();
 		}
 
@@ -83,14 +141,17 @@ namespace ares_impl {
 	template <typename T>
 	struct do_serialize<T, serialize_type::trivial> {
 		static T read(byte_array &bs) {
-			const byte *p = bs.read(sizeof(T));
-			return std::move(*reinterpret_cast<const T *>(p));
+			T v;
+			memcpy((void *)&v, bs.read(sizeof(T)), sizeof(T));
+			return v;
 		}
 
 		static void write(const T &v, byte_array &bs) {
 			const byte *p = reinterpret_cast<const byte *>(&v);
 			bs.write(p, sizeof(T));
 		}
+
+		static size_t size(const T &) { return sizeof(T); }
 	};
 
 	template <typename T>
@@ -102,6 +163,9 @@ namespace ares_impl {
 		static void write(const T &v, byte_array &bs) {
 			v.write_to(bs);
 		}
+
+		// only a guess, the layout is up to write_to
+		static size_t size(const T &) { return sizeof(T); }
 	};
 
 	template <typename T>
@@ -117,26 +181,66 @@ namespace ares_impl {
 
 		static T read(byte_array &bs);
 		static void write(const T &v, byte_array &bs);
+		static size_t size(const T &v);
 	};
 
 	template <typename T>
 	struct do_serialize<collection<T>, serialize_type::unknow> {
+		// elements of bulk types are stored contiguously, copy them at once
+		typedef std::integral_constant<bool,
+				serialize_type_of<T>::value == serialize_type::trivial &&
+				!std::is_same<T, bool>::value> bulk;
+
 		static collection<T> read(byte_array &bs) {
 			size_t s = bs.read<size_t>();
 			collection<T> cc;
+			read(bs, s, cc, bulk());
+			return std::move(cc);
+		}
+
+		static void write(const collection<T> &cc, byte_array &bs) {
+			bs.write(cc.size());
+			write(cc, bs, bulk());
+		}
+
+		static size_t size(const collection<T> &cc) {
+			return sizeof(size_t) + size(cc, bulk());
+		}
+
+	private:
+		static void read(byte_array &bs, size_t s, collection<T> &cc, std::true_type) {
+			cc.resize(s);
+			memcpy((void *)cc.data(), bs.read(s * sizeof(T)), s * sizeof(T));
+		}
+
+		static void read(byte_array &bs, size_t s, collection<T> &cc, std::false_type) {
 			cc.reserve(s);
 			for (size_t i = 0; i < s; ++i) {
 				cc.push_back(bs.read<T>());
 			}
-			return std::move(cc);
 		}
 
-		static void write(const collection<T> &cc, byte_array &bs) {
-			bs.write(cc.size());
+		static void write(const collection<T> &cc, byte_array &bs, std::true_type) {
+			bs.write(reinterpret_cast<const byte *>(cc.data()), cc.size() * sizeof(T));
+		}
+
+		static void write(const collection<T> &cc, byte_array &bs, std::false_type) {
 			for (const T &t : cc) {
 				bs.write(t);
 			}
 		}
+
+		static size_t size(const collection<T> &cc, std::true_type) {
+			return cc.size() * sizeof(T);
+		}
+
+		static size_t size(const collection<T> &cc, std::false_type) {
+			size_t s = 0;
+			for (const T &t : cc) {
+				s += serialize<T>::size(t);
+			}
+			return s;
+		}
 	};
 
 	template <typename K, typename V>
@@ -151,6 +255,51 @@ namespace ares_impl {
 			bs.write(p.first);
 			bs.write(p.second);
 		}
+
+		static size_t size(const pair<K, V> &p) {
+			return serialize<K>::size(p.first) + serialize<V>::size(p.second);
+		}
+	};
+
+	// tuples with padding or members that are not bulk, a member at a time
+	template <typename ... Ts>
+	struct do_serialize<std::tuple<Ts...>, serialize_type::unknow> {
+		typedef std::tuple<Ts...> tuple_t;
+		template <size_t I> using at = std::integral_constant<size_t, I>;
+		typedef at<sizeof...(Ts)> end_t;
+
+		static tuple_t read(byte_array &bs) {
+			tuple_t t;
+			read(bs, t, at<0>());
+			return t;
+		}
+
+		static void write(const tuple_t &t, byte_array &bs) {
+			write(t, bs, at<0>());
+		}
+
+		static size_t size(const tuple_t &t) {
+			return size(t, at<0>());
+		}
+
+	private:
+		static void read(byte_array &, tuple_t &, end_t) {}
+		template <size_t I> static void read(byte_array &bs, tuple_t &t, at<I>) {
+			std::get<I>(t) = bs.read<typename std::tuple_element<I, tuple_t>::type>();
+			read(bs, t, at<I + 1>());
+		}
+
+		static void write(const tuple_t &, byte_array &, end_t) {}
+		template <size_t I> static void write(const tuple_t &t, byte_array &bs, at<I>) {
+			bs.write(std::get<I>(t));
+			write(t, bs, at<I + 1>());
+		}
+
+		static size_t size(const tuple_t &, end_t) { return 0; }
+		template <size_t I> static size_t size(const tuple_t &t, at<I>) {
+			typedef typename std::tuple_element<I, tuple_t>::type T;
+			return serialize<T>::size(std::get<I>(t)) + size(t, at<I + 1>());
+		}
 	};
 
 	template <typename C>
@@ -167,8 +316,59 @@ namespace ares_impl {
 			const byte *p = reinterpret_cast<const byte *>(s.data());
 			bs.write(p, s.size() * sizeof(C));
 		}
+
+		static size_t size(const std::basic_string<C> &s) {
+			return sizeof(size_t) + s.size() * sizeof(C);
+		}
+	};
+
+	/* views read in place: the bytes stay in the byte_array read from,
+	 * which must outlive them. written like what they view, so either
+	 * reads the other
+	 */
+	template <>
+	struct do_serialize<string_view, serialize_type::unknow> {
+		static string_view read(byte_array &bs) {
+			size_t l = bs.read<size_t>();
+			return string_view(reinterpret_cast<const char *>(bs.read(l)), l);
+		}
+
+		static void write(const string_view &s, byte_array &bs) {
+			bs.write(s.size());
+			bs.write(reinterpret_cast<const byte *>(s.data()), s.size());
+		}
+
+		static size_t size(const string_view &s) {
+			return sizeof(size_t) + s.size();
+		}
+	};
+
+	template <typename T>
+	struct do_serialize<span<T>, serialize_type::unknow> {
+		static_assert(!std::is_same<T, bool>::value, "no span of bool, as no bulk collection of it");
+
+		static span<T> read(byte_array &bs) {
+			size_t s = bs.read<size_t>();
+			return span<T>(bs.read(s * sizeof(T)), s);
+		}
+
+		static void write(const span<T> &s, byte_array &bs) {
+			bs.write(s.size());
+			for (T v : s) {
+				bs.write(v);
+			}
+		}
+
+		static size_t size(const span<T> &s) {
+			return sizeof(size_t) + s.size() * sizeof(T);
+		}
 	};
 
+	// bytes v takes once written to a byte_array, without writing it
+	template <typename T> size_t wire_size(const T &v) {
+		return serialize<T>::size(v);
+	}
+
 }
 
 #endif // _ARES_BYTES_HPP_
@@ -0,0 +1,280 @@
+
+#ifndef _ARES_CHUNKS_HPP_
+#define _ARES_CHUNKS_HPP_
+
+#include "mpi.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+
+namespace ares_impl {
+
+	/* dynamic scheduling of the map input: the input is cut into many
+	 * chunks which the master hands out one at a time, so a rank that gets
+	 * through its chunks early asks for more instead of waiting for the
+	 * others at the shuffle.
+	 *
+	 * a worker asks with a message listing the chunks it finished since
+	 * its last message, the master answers with a header (chunk index,
+	 * chunk count, payload bytes) and then the payload, the serialized
+	 * chunk for scattered data, nothing for a file, whose chunks every
+	 * rank reads itself. an index past the count means nothing is left; the
+	 * worker then sends one last list once its map is done. only the MPI
+	 * thread calls any of this, the master between its own batches, so
+	 * that it keeps mapping too.
+	 *
+	 * when speculating, a rank asking after every chunk has been handed out
+	 * gets a second copy of a chunk still running elsewhere. the first
+	 * rank the master hears finished a chunk owns it; the master tells the
+	 * ranks running the other copies to stop them, and settle() tells
+	 * every rank the owners, so that the other copies' output is dropped.
+	 */
+	class chunk_queue {
+		static constexpr int ASK_TAG = 0x5e00;
+		static constexpr int GIVE_TAG = 0x5e01;
+		static constexpr int STOP_TAG = 0x5e02;
+		static constexpr uint64_t ASK = 0, LAST = 1;
+		static constexpr size_t COPIES = 2;
+
+		mpi_controller &mpi;
+		const collection<byte_array> *chunks;
+		size_t total;
+		bool speculate;
+
+		// master: next fresh chunk, ranks running each chunk, and the
+		// rank that finished it first
+		size_t next = 0;
+		size_t lasts = 0;
+		collection<collection<int>> running;
+		collection<int32_t> owner;
+		collection<uint64_t> stops_sent;
+
+		// worker: whether an answer is pending, and chunks not reported yet
+		bool asked = false;
+		collection<uint64_t> finished;
+		uint64_t stops_got = 0;
+
+		// copies this rank is to stop, not yet passed on by stopped()
+		collection<uint64_t> stops;
+
+		std::deque<collection<uint64_t>> sending;
+		collection<MPI_Request> reqs;
+		collection<byte_array> inbox;
+
+	public:
+		// chunks is null for a file cut into total chunks
+		chunk_queue(mpi_controller &mpi, const collection<byte_array> *chunks,
+				size_t total, bool speculate):
+				mpi(mpi), chunks(chunks), total(total), speculate(speculate),
+				running(total), owner(total, -1), stops_sent(mpi.size(), 0),
+				inbox(mpi.size()) {}
+
+		~chunk_queue() {
+			mpi.wait(reqs);
+		}
+
+		// master: answers the messages that have arrived
+		void serve() {
+			if ( !mpi.is_m() ) {
+				return;
+			}
+			size_t len;
+			int source;
+			while ( (source = mpi.recv_any(ASK_TAG, inbox.data(), len, false)) >= 0 ) {
+				byte_array &msg = inbox[source];
+				uint64_t kind = msg.read<uint64_t>();
+				while ( msg.remain() > 0 ) {
+					done(msg.read<uint64_t>(), source);
+				}
+				msg.clear();
+				if ( kind == ASK ) {
+					give(source);
+				} else {
+					++lasts;
+				}
+			}
+			if ( mpi.test(reqs) ) {
+				sending.clear();
+			}
+		}
+
+		// master: whether every worker has sent its last list
+		bool closed() const {
+			return !mpi.is_m() || lasts + 1 == mpi.size();
+		}
+
+		/* the next chunk for this rank: 1 when index, count and data (a view
+		 * on the master) are set, 0 when nothing is left, -1 while a worker
+		 * still waits for the master's answer
+		 */
+		int take(size_t &index, size_t &count, byte_array &data) {
+			if ( mpi.is_m() ) {
+				serve();
+				index = pick(mpi.id());
+				count = total;
+				if ( index >= total ) {
+					return 0;
+				}
+				if ( chunks != nullptr ) {
+					data = (*chunks)[index].view();
+				}
+				return 1;
+			}
+
+			if ( !asked ) {
+				report(ASK);
+				asked = true;
+			}
+			size_t len;
+			byte_array &head = inbox[mpi.master()];
+			if ( mpi.recv_any(GIVE_TAG, inbox.data(), len, false) < 0 ) {
+				return -1;
+			}
+			asked = false;
+			index = head.read<uint64_t>();
+			count = total = head.read<uint64_t>();
+			size_t bytes = head.read<uint64_t>();
+			head.clear();
+			if ( index >= count ) {
+				return 0;
+			}
+			if ( bytes > 0 ) {
+				mpi.irecv(data.grow(bytes), bytes, mpi.master(), GIVE_TAG, reqs);
+				mpi.wait(reqs);
+			}
+			return 1;
+		}
+
+		// this rank has mapped all of chunk index
+		void done(size_t index) {
+			if ( mpi.is_m() ) {
+				done(index, mpi.id());
+			} else {
+				finished.push_back(index);
+			}
+		}
+
+		// worker: this rank will take no more chunks
+		void finish() {
+			if ( !mpi.is_m() ) {
+				report(LAST);
+			}
+		}
+
+		// the chunks another rank finished first since the last call, whose
+		// copy this rank can stop mapping
+		collection<uint64_t> stopped() {
+			size_t len;
+			if ( !mpi.is_m() ) {
+				while ( mpi.recv_any(STOP_TAG, inbox.data(), len, false) >= 0 ) {
+					take_stop();
+				}
+			}
+			collection<uint64_t> now;
+			now.swap(stops);
+			return now;
+		}
+
+		/* once closed() on the master, every rank calls this to learn the
+		 * rank owning each chunk. stops still on their way are received
+		 * here, so none is left for the next job
+		 */
+		collection<int32_t> settle() {
+			size_t size = mpi.size(), len;
+			byte_array bytes;
+			if ( mpi.is_m() ) {
+				bytes.write(reinterpret_cast<const byte *>(owner.data()), total * sizeof(int32_t));
+				bytes.write(reinterpret_cast<const byte *>(stops_sent.data()), size * sizeof(uint64_t));
+			}
+			mpi.bcast(bytes, total * sizeof(int32_t) + size * sizeof(uint64_t));
+			collection<int32_t> owners(total);
+			memcpy(owners.data(), bytes.read(total * sizeof(int32_t)), total * sizeof(int32_t));
+			memcpy(stops_sent.data(), bytes.read(size * sizeof(uint64_t)), size * sizeof(uint64_t));
+			while ( stops_got < stops_sent[mpi.id()] ) {
+				mpi.recv_any(STOP_TAG, inbox.data(), len, true);
+				take_stop();
+			}
+			stops.clear();
+			return owners;
+		}
+
+	private:
+		void report(uint64_t kind) {
+			if ( mpi.test(reqs) ) {
+				sending.clear();
+			}
+			sending.emplace_back();
+			collection<uint64_t> &msg = sending.back();
+			msg.push_back(kind);
+			msg.insert(msg.end(), finished.begin(), finished.end());
+			finished.clear();
+			mpi.isend((const byte *)msg.data(), msg.size() * sizeof(uint64_t),
+					mpi.master(), ASK_TAG, reqs);
+		}
+
+		// the first rank to finish a chunk owns it, the others stop theirs
+		void done(size_t index, int rank) {
+			if ( index >= total || owner[index] >= 0 ) {
+				return;
+			}
+			owner[index] = rank;
+			for (int other : running[index]) {
+				if ( other == rank ) {
+					continue;
+				} else if ( other == mpi.id() ) {
+					stops.push_back(index);
+				} else {
+					sending.push_back(collection<uint64_t>{ index });
+					mpi.isend((const byte *)sending.back().data(), sizeof(uint64_t), other, STOP_TAG, reqs);
+					++stops_sent[other];
+				}
+			}
+		}
+
+		void take_stop() {
+			byte_array &msg = inbox[mpi.master()];
+			stops.push_back(msg.read<uint64_t>());
+			msg.clear();
+			++stops_got;
+		}
+
+		// a fresh chunk, else a copy of the unfinished chunk with the fewest
+		// copies that rank is not running yet, else total
+		size_t pick(int rank) {
+			size_t c = total;
+			if ( next < total ) {
+				c = next++;
+			} else if ( speculate ) {
+				for (size_t i = 0; i < total; ++i) {
+					const collection<int> &r = running[i];
+					if ( owner[i] < 0 && r.size() < COPIES &&
+							std::find(r.begin(), r.end(), rank) == r.end() &&
+							(c == total || r.size() < running[c].size()) ) {
+						c = i;
+					}
+				}
+			}
+			if ( c < total ) {
+				running[c].push_back(rank);
+			}
+			return c;
+		}
+
+		void give(int dest) {
+			size_t index = pick(dest);
+			const byte_array *payload = index < total && chunks ? &(*chunks)[index] : nullptr;
+			uint64_t bytes = payload ? payload->size() : 0;
+
+			sending.push_back(collection<uint64_t>{ index, total, bytes });
+			mpi.isend((const byte *)sending.back().data(), 3 * sizeof(uint64_t), dest, GIVE_TAG, reqs);
+			if ( bytes > 0 ) {
+				mpi.isend(payload->data(), bytes, dest, GIVE_TAG, reqs);
+			}
+		}
+	};
+
+}
+
+#endif // _ARES_CHUNKS_HPP_
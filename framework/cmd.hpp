@@ -6,10 +6,20 @@ namespace ares_impl {
 
 	enum class opt_code {
 		map_data,
+		map_file,
 		m_side_data,
 		r_side_data,
 		c_side_data,
+		config,
 		start,
+		iterate,
+		keep_dataset,
+		map_dataset,
+		gather_dataset,
+		drop_dataset,
+		write_results,
+		keep_stream,
+		stream_part,
 		exit
 	};
 
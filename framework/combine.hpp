@@ -0,0 +1,84 @@
+
+#ifndef _ARES_COMBINE_HPP_
+#define _ARES_COMBINE_HPP_
+
+#include "arena.hpp"
+#include "types.hpp"
+
+#include <memory>
+
+namespace ares_impl {
+
+	// lets do_map call the job's combiner without knowing its type
+	template <typename K, typename V> struct combiner_base {
+		virtual ~combiner_base() {}
+		virtual pair<K, V> combine(const K &key, const collection<V> &values) = 0;
+	};
+
+	template <typename C> struct combiner_impl: combiner_base<
+			typename combine_func_type<C>::key_t,
+			typename combine_func_type<C>::val_t> {
+		typedef combine_func_type<C> combine_func;
+		typedef typename combine_func::key_t key_t;
+		typedef typename combine_func::val_t val_t;
+
+		std::shared_ptr<typename combine_func::combine_t> combiner;
+
+		pair<key_t, val_t> combine(const key_t &key, const collection<val_t> &values) override {
+			collection<typename combine_func::param_val_t> params;
+			return combiner->combine(key, as_params(values, params));
+		}
+	};
+
+	/* in-mapper combining: map output is collected per key and folded
+	 * with the combiner as it arrives, so a key emitted many times holds
+	 * at most FOLD values. once capacity keys are held the whole table is
+	 * flushed, which bounds its memory; with use_arena, the table lives in
+	 * an arena that is released at every flush.
+	 */
+	template <typename K, typename V> class combine_buffer {
+		static constexpr size_t FOLD = 8;
+
+		combiner_base<K, V> *comb;
+		size_t capacity;
+		arena pool;
+		arena *table_pool;
+		group_map<K, V> table;
+
+	public:
+		combine_buffer(combiner_base<K, V> *comb, size_t capacity, bool use_arena):
+				comb(comb), capacity(capacity), table_pool(use_arena ? &pool : nullptr),
+				table(make_group_map<K, V>(table_pool)) {}
+
+		~combine_buffer() { delete comb; }
+
+		void insert(pair<K, V> &&p) {
+			collection<V> &values = table[p.first];
+			values.push_back(std::move(p.second));
+			if ( values.size() >= FOLD ) {
+				V v = comb->combine(p.first, values).second;
+				values.clear();
+				values.push_back(std::move(v));
+			}
+		}
+
+		bool full() const { return table.size() >= capacity; }
+
+		// hands every key with its folded value to emit and empties the table
+		template <typename F> void flush(F &&emit) {
+			for (auto &part : table) {
+				if ( part.second.size() == 1 ) {
+					emit(make_pair(part.first, std::move(part.second[0])));
+				} else {
+					emit(comb->combine(part.first, part.second));
+				}
+			}
+			// the buckets too are in the arena, so the table goes first
+			make_group_map<K, V>(table_pool).swap(table);
+			pool.release();
+		}
+	};
+
+}
+
+#endif // _ARES_COMBINE_HPP_
@@ -0,0 +1,185 @@
+
+#ifndef _ARES_COMPRESS_HPP_
+#define _ARES_COMPRESS_HPP_
+
+#include "bytes.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace ares_impl {
+
+	/* a small lz77 codec for buffers on the wire. the input is cut into
+	 * blocks of at most BLOCK bytes, each written as
+	 *
+	 *   uint32 raw size, uint32 packed size, packed bytes
+	 *
+	 * where a block that does not shrink is stored as is (packed == raw),
+	 * so encoded buffers can be appended to each other and still decode.
+	 * a packed block is a series of
+	 *
+	 *   varint literal count, literals, varint offset, varint match length - 4
+	 *
+	 * ending with a literal run. the fixed size length prefixes of the
+	 * serialized data are mostly zero bytes and repeated keys are matches,
+	 * so both shrink without the codec knowing the layout.
+	 */
+	namespace lz {
+
+		static constexpr size_t BLOCK = 1 << 20;
+		static constexpr size_t WINDOW = 1 << 16;
+		static constexpr int HASH_BITS = 14;
+		static constexpr size_t MIN_MATCH = 4;
+
+		inline byte *put_varint(byte *p, size_t v) {
+			while ( v >= 0x80 ) {
+				*p++ = (byte)(v | 0x80);
+				v >>= 7;
+			}
+			*p++ = (byte)v;
+			return p;
+		}
+
+		// false when the varint runs past end
+		inline bool get_varint(const byte *&p, const byte *end, size_t &v) {
+			v = 0;
+			for (int shift = 0; p < end && shift < 64; shift += 7) {
+				byte b = *p++;
+				v |= (size_t)(b & 0x7f) << shift;
+				if ( (b & 0x80) == 0 ) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// worst case size of a packed block of n bytes
+		inline size_t bound(size_t n) {
+			return n + n / 4 + 16;
+		}
+
+		inline uint32_t hash4(const byte *p) {
+			uint32_t v;
+			memcpy(&v, p, sizeof(v));
+			return (v * 2654435761u) >> (32 - HASH_BITS);
+		}
+
+		// packs n <= BLOCK bytes into out, which holds bound(n) bytes
+		inline size_t pack(const byte *in, size_t n, byte *out) {
+			uint32_t table[1 << HASH_BITS];
+			memset(table, 0, sizeof(table));
+
+			byte *op = out;
+			size_t i = 0, anchor = 0, misses = 0;
+			while ( n >= MIN_MATCH && i + MIN_MATCH <= n ) {
+				uint32_t &slot = table[hash4(in + i)];
+				size_t cand = slot;
+				slot = (uint32_t)i;
+				if ( cand >= i || i - cand > WINDOW || memcmp(in + cand, in + i, MIN_MATCH) != 0 ) {
+					// skip faster through data that does not repeat
+					i += 1 + (misses++ >> 6);
+					continue;
+				}
+				size_t len = MIN_MATCH;
+				while ( i + len < n && in[cand + len] == in[i + len] ) {
+					++len;
+				}
+				op = put_varint(op, i - anchor);
+				memcpy(op, in + anchor, i - anchor);
+				op += i - anchor;
+				op = put_varint(op, i - cand);
+				op = put_varint(op, len - MIN_MATCH);
+				i += len;
+				anchor = i;
+				misses = 0;
+			}
+			op = put_varint(op, n - anchor);
+			memcpy(op, in + anchor, n - anchor);
+			op += n - anchor;
+			return op - out;
+		}
+
+		// unpacks a packed block into exactly raw bytes at out
+		inline bool unpack(const byte *in, size_t n, byte *out, size_t raw) {
+			const byte *end = in + n;
+			size_t o = 0, lit, off, len;
+			while ( true ) {
+				if ( !get_varint(in, end, lit) || lit > (size_t)(end - in) || lit > raw - o ) {
+					return false;
+				}
+				memcpy(out + o, in, lit);
+				in += lit;
+				o += lit;
+				if ( in == end ) {
+					return o == raw;
+				}
+				if ( !get_varint(in, end, off) || !get_varint(in, end, len) ) {
+					return false;
+				}
+				len += MIN_MATCH;
+				if ( off == 0 || off > o || len > raw - o ) {
+					return false;
+				}
+				// the match may overlap what it produces
+				for (size_t j = 0; j < len; ++j, ++o) {
+					out[o] = out[o - off];
+				}
+			}
+		}
+
+		/* appends n bytes from in to out as blocks; with store, they are
+		 * not compressed (for data that stays on this rank)
+		 */
+		inline void encode(const byte *in, size_t n, byte_array &out, bool store = false) {
+			for (size_t done = 0; done < n; done += BLOCK) {
+				uint32_t raw = (uint32_t)std::min(n - done, BLOCK);
+				size_t base = out.size();
+				byte *head = out.grow(2 * sizeof(uint32_t) + bound(raw));
+				byte *body = head + 2 * sizeof(uint32_t);
+
+				uint32_t packed = store ? raw : (uint32_t)pack(in + done, raw, body);
+				if ( packed >= raw ) {
+					packed = raw;
+					memcpy(body, in + done, raw);
+				}
+				memcpy(head, &raw, sizeof(raw));
+				memcpy(head + sizeof(raw), &packed, sizeof(packed));
+				out.truncate(base + 2 * sizeof(uint32_t) + packed);
+			}
+		}
+
+		// appends what a series of blocks in holds to out
+		inline bool decode(const byte_array &in, byte_array &out) {
+			const byte *p = in.data(), *end = p + in.size();
+			while ( p < end ) {
+				uint32_t raw, packed;
+				if ( (size_t)(end - p) < 2 * sizeof(uint32_t) ) {
+					break;
+				}
+				memcpy(&raw, p, sizeof(raw));
+				memcpy(&packed, p + sizeof(raw), sizeof(packed));
+				p += 2 * sizeof(uint32_t);
+				if ( packed > (size_t)(end - p) ) {
+					break;
+				}
+
+				byte *dest = out.grow(raw);
+				if ( packed == raw ) {
+					memcpy(dest, p, raw);
+				} else if ( !unpack(p, packed, dest, raw) ) {
+					break;
+				}
+				p += packed;
+			}
+			if ( p != end ) {
+				fprintf(stderr, "corrupt compressed buffer\n");
+				return false;
+			}
+			return true;
+		}
+	}
+}
+
+#endif // _ARES_COMPRESS_HPP_
@@ -0,0 +1,89 @@
+
+#ifndef _ARES_CONFIG_HPP_
+#define _ARES_CONFIG_HPP_
+
+#include <cstddef>
+
+namespace ares_impl {
+
+	enum class grouping {
+		hash,	// one hash map entry per key
+		sort	// radix sort the pairs into runs of equal keys: integral
+				// keys come in key order, others in the order of their hash
+	};
+
+	/* runtime options, set on the master and broadcast to every rank
+	 * before the next job; must stay trivially copyable
+	 */
+	struct config {
+		// threads running map inside each rank
+		size_t map_threads = 1;
+
+		// bytes of input per chunk when the ranks pull map input from the
+		// master chunk by chunk, as they get through it; 0 splits the input
+		// once, evenly. takes effect at the next scatter
+		size_t map_chunk = 0;
+
+		// with map_chunk, hand idle ranks a second copy of the chunks still
+		// running once none is left, keeping whichever copy ends first and
+		// stopping the other; the map output is then held per chunk, so it
+		// is neither combined in the map buffer nor pipelined until map is
+		// over
+		bool speculate = false;
+
+		// serialized bytes of map output a rank buffers before shipping it
+		// in a pipelined shuffle round; 0 shuffles everything after map at
+		// once. this bounds the sending side only: the rounds a rank
+		// receives are held, serialized, until reduce, so it still ends up
+		// with all of its share of the map output. use spill_budget to
+		// bound that too
+		size_t shuffle_budget = 0;
+
+		// bytes of map output a rank holds in memory; past it the buckets
+		// are spilled to temp files as sorted runs, which are shuffled a run
+		// at a time and merged from disk by reduce. 0 keeps everything in
+		// memory. spilling replaces the pipelined shuffle and keeps hot keys
+		// on their home rank
+		size_t spill_budget = 0;
+
+		// shuffle in two levels: the ranks of a node send their buckets
+		// to the node's lowest rank, which combines them and swaps them
+		// with the other nodes' leaders, so fewer and larger messages
+		// cross the network. not used by the pipelined or spilled shuffle
+		bool node_shuffle = false;
+
+		// with node_shuffle, group ranks k - k % ranks_per_node into a node,
+		// to try it on one machine; 0 groups the ranks sharing memory
+		size_t ranks_per_node = 0;
+
+		// distinct keys each map thread folds with the combiner before they
+		// go to the shuffle buckets; 0 only combines after map
+		size_t combine_buffer = 0;
+
+		// map output pairs each map thread samples for hot keys, which are
+		// then spread over several reducers and merged with the combiner;
+		// 0 (or a job without combiner) keeps every key on its home rank
+		size_t skew_sample = 0;
+
+		// send the buffers of scatter, shuffle and gather as lz blocks,
+		// trading cpu time for fewer bytes on the network
+		bool compress = false;
+
+		// allocate the nodes and buckets of the hash tables grouping map
+		// output by key, in the combine buffer, the combiner and reduce,
+		// from arenas freed at once when they are done with. the keys and
+		// value collections in those nodes are the types map emits and
+		// reduce takes, so they stay on the heap, as does map output
+		bool arena = false;
+
+		// how do_reduce collects the values of each key
+		grouping group = grouping::hash;
+
+		// time every phase of a job on each rank and have the master
+		// write a json report of it, see set_profile_output
+		bool profile = false;
+	};
+
+}
+
+#endif // _ARES_CONFIG_HPP_
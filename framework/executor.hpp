@@ -0,0 +1,82 @@
+
+#ifndef _ARES_EXECUTOR_HPP_
+#define _ARES_EXECUTOR_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ares_impl {
+
+	/* runs tasks one after the other, in the order posted, on a thread of
+	 * its own started by the first post. the master runs submitted jobs on
+	 * it, so only one job talks to the other ranks at a time while the
+	 * caller goes on with its own work.
+	 */
+	class executor {
+		std::mutex lock;
+		std::condition_variable changed;
+		std::deque<std::function<void()>> tasks;
+		bool busy = false;
+		bool stopping = false;
+		std::thread thread;
+
+	public:
+		executor() = default;
+		executor(const executor &) = delete;
+		executor &operator=(const executor &) = delete;
+
+		~executor() { stop(); }
+
+		void post(std::function<void()> task) {
+			std::lock_guard<std::mutex> guard(lock);
+			tasks.push_back(std::move(task));
+			if ( !thread.joinable() ) {
+				thread = std::thread(&executor::run, this);
+			}
+			changed.notify_all();
+		}
+
+		// waits until every task posted so far has run
+		void drain() {
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [this] { return tasks.empty() && !busy; });
+		}
+
+		// runs what is left, then ends the thread
+		void stop() {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+				changed.notify_all();
+			}
+			if ( thread.joinable() ) {
+				thread.join();
+			}
+		}
+
+	private:
+		void run() {
+			std::unique_lock<std::mutex> guard(lock);
+			while ( true ) {
+				changed.wait(guard, [this] { return !tasks.empty() || stopping; });
+				if ( tasks.empty() ) {
+					return;
+				}
+				std::function<void()> task = std::move(tasks.front());
+				tasks.pop_front();
+				busy = true;
+				guard.unlock();
+				task();
+				guard.lock();
+				busy = false;
+				changed.notify_all();
+			}
+		}
+	};
+
+}
+
+#endif // _ARES_EXECUTOR_HPP_
@@ -0,0 +1,116 @@
+
+#ifndef _ARES_GROUP_HPP_
+#define _ARES_GROUP_HPP_
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <functional>
+
+namespace ares_impl {
+
+	/* sort based grouping: instead of one hash map node and one vector per
+	 * key, the pairs are ordered by a radix sort over (sort key, index) and
+	 * handed out as runs of equal keys.
+	 *
+	 * integral keys but bool are sorted by value, so runs come out in key
+	 * order. other keys are sorted by their hash, so their runs come in no
+	 * useful order, and the rare runs where different keys share a hash
+	 * are split by comparing keys.
+	 */
+	namespace group {
+
+		typedef pair<uint64_t, size_t> item_t;
+
+		template <typename T> using by_value = std::integral_constant<bool,
+				std::is_integral<T>::value && !std::is_same<T, bool>::value>;
+
+		template <typename T>
+		typename std::enable_if<by_value<T>::value, uint64_t>::type
+		sort_key(const T &k, int &bytes) {
+			typedef typename std::make_unsigned<T>::type U;
+			U u = (U)k;
+			if ( std::is_signed<T>::value ) {
+				u ^= (U)1 << (sizeof(U) * 8 - 1);
+			}
+			bytes = sizeof(U);
+			return u;
+		}
+
+		template <typename T>
+		typename std::enable_if<!by_value<T>::value, uint64_t>::type
+		sort_key(const T &k, int &bytes) {
+			bytes = sizeof(uint64_t);
+			return std::hash<T>()(k);
+		}
+
+		// stable lsd radix sort on the first `bytes` bytes of item.first
+		inline void radix_sort(collection<item_t> &items, int bytes) {
+			collection<item_t> scratch(items.size());
+			for (int shift = 0; shift < bytes * 8; shift += 8) {
+				size_t counts[256] = { 0 };
+				for (const item_t &i : items) {
+					++counts[(i.first >> shift) & 0xff];
+				}
+				if ( counts[(items[0].first >> shift) & 0xff] == items.size() ) {
+					continue;
+				}
+				size_t sum = 0;
+				for (size_t &c : counts) {
+					size_t t = c;
+					c = sum;
+					sum += t;
+				}
+				for (const item_t &i : items) {
+					scratch[counts[(i.first >> shift) & 0xff]++] = i;
+				}
+				items.swap(scratch);
+			}
+		}
+
+		/* calls f(key, values) once per distinct key of pairs; values is
+		 * reused between calls and the pairs are moved from
+		 */
+		template <typename K, typename V, typename F>
+		void sort_group(collection<pair<K, V>> &pairs, F &&f) {
+			if ( pairs.empty() ) {
+				return;
+			}
+
+			int bytes = 0;
+			collection<item_t> items(pairs.size());
+			for (size_t i = 0; i < pairs.size(); ++i) {
+				items[i] = make_pair(sort_key(pairs[i].first, bytes), i);
+			}
+			radix_sort(items, bytes);
+
+			collection<V> values;
+			collection<size_t> rest;
+			for (size_t b = 0, e = 0; b < items.size(); b = e) {
+				while ( e < items.size() && items[e].first == items[b].first ) {
+					++e;
+				}
+				// normally a single key, unless hashes collide
+				for (size_t i = b; i < e; ++i) {
+					rest.push_back(items[i].second);
+				}
+				while ( !rest.empty() ) {
+					const K &key = pairs[rest[0]].first;
+					size_t n = 0;
+					for (size_t idx : rest) {
+						if ( pairs[idx].first == key ) {
+							values.push_back(std::move(pairs[idx].second));
+						} else {
+							rest[n++] = idx;
+						}
+					}
+					rest.resize(n);
+					f(key, values);
+					values.clear();
+				}
+			}
+		}
+	}
+}
+
+#endif // _ARES_GROUP_HPP_
@@ -5,6 +5,7 @@
 #include "types.hpp"
 
 #include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <string>
 
@@ -40,6 +41,57 @@ namespace ares_impl {
 			}
 			return std::move(result);
 		}
+
+		// bytes in the file, 0 if it cannot be opened
+		size_t filesize(const std::string &name) {
+			std::ifstream in(name, std::ios::binary | std::ios::ate);
+			return in ? (size_t)in.tellg() : 0;
+		}
+
+		/* the lines starting in the part-th of parts equal byte ranges of
+		 * the file, so that the parts together cover every line once
+		 */
+		collection<std::string> readfile(const std::string &name, size_t part, size_t parts) {
+			collection<std::string> result;
+			std::ifstream in(name, std::ios::binary);
+			if ( !in ) {
+				fprintf(stderr, "cannot open %s\n", name.c_str());
+				return result;
+			}
+			in.seekg(0, std::ios::end);
+			size_t total = in.tellg();
+			size_t begin = total * part / parts, end = total * (part + 1) / parts;
+
+			// a line straddling begin belongs to the previous part
+			if ( begin > 0 ) {
+				in.seekg(begin - 1);
+				if ( in.get() != '\n' ) {
+					std::string skip;
+					getline(in, skip);
+				}
+			} else {
+				in.seekg(0);
+			}
+
+			std::string block;
+			size_t pos = in.tellg();
+			if ( pos < end ) {
+				block.resize(end - pos);
+				in.read(&block[0], block.size());
+			}
+			size_t b = 0, e;
+			while ( (e = block.find('\n', b)) != std::string::npos ) {
+				result.emplace_back(block, b, e - b);
+				b = e + 1;
+			}
+			if ( b < block.size() ) {
+				// finish the last line past end
+				std::string tail;
+				getline(in, tail);
+				result.push_back(block.substr(b) + tail);
+			}
+			return result;
+		}
 	}
 }
 
@@ -4,20 +4,46 @@
 
 #include "bytes.hpp"
 #include "cmd.hpp"
+#include "config.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <functional>
 
-namespace ares_impl {
+#include <mpi.h>
+
+// largest count passed to a single MPI call, lower it to test the chunked paths
+#ifndef ARES_MAX_COUNT
+#define ARES_MAX_COUNT INT_MAX
+#endif
 
-#include "mpi.h"
+namespace ares_impl {
 
+	/* sizes travel as 64-bit counts. a collective whose counts or
+	 * displacements would overflow the int arguments of MPI falls back to
+	 * point-to-point messages of at most MAX_COUNT bytes each
+	 */
 	class mpi_controller {
-		static constexpr MPI_Comm WORLD = MPI_COMM_WORLD;
+		const MPI_Comm WORLD = MPI_COMM_WORLD;
 		static constexpr int MASTER_ID = 0;
+		static constexpr int CHUNK_TAG = 0x4c00;
+		static constexpr int NODE_UP_TAG = 0x4d00;
+		static constexpr int NODE_ACROSS_TAG = 0x4d01;
+		static constexpr int NODE_DOWN_TAG = 0x4d02;
+		static constexpr size_t MAX_COUNT = ARES_MAX_COUNT;
+		static constexpr size_t BCAST_CHUNK = 1 << 20;
 
 		int _id;
 		size_t _size;
 
+		// the leader (lowest rank) of every rank's node, for the
+		// ranks_per_node it was found with
+		collection<int> leader_of;
+		size_t nodes_for = (size_t)-1;
+
 	public:
 		mpi_controller() {
 			MPI_Comm_rank(MPI_COMM_WORLD, &_id);
@@ -35,99 +61,466 @@ namespace ares_impl {
 			MPI_Bcast(&head, (int)sizeof(head), MPI_BYTE, master(), WORLD);
 		}
 
+		void bcast(config &conf) {
+			MPI_Bcast(&conf, (int)sizeof(conf), MPI_BYTE, master(), WORLD);
+		}
+
+		// the master sends data, the others append len bytes to it
 		void bcast(byte_array &data, size_t len) {
-			byte *buf = new byte[len];
-			if ( is_m() ) {
-				memcpy(buf, data.data(), len);
+			byte *buf = is_m() ? (byte *)data.data() : data.grow(len);
+			for (size_t done = 0; done < len; done += MAX_COUNT) {
+				size_t one = std::min(len - done, (size_t)MAX_COUNT);
+				MPI_Bcast(buf + done, (int)one, MPI_BYTE, master(), WORLD);
+			}
+		}
+
+		/* bcast as chunks of BCAST_CHUNK bytes all in flight at once, so a
+		 * large buffer streams down the broadcast tree instead of crossing
+		 * it one level at a time
+		 */
+		void bcast_pipelined(byte_array &data, size_t len) {
+			byte *buf = is_m() ? (byte *)data.data() : data.grow(len);
+			collection<MPI_Request> reqs;
+			for (size_t done = 0; done < len; done += BCAST_CHUNK) {
+				size_t one = std::min(len - done, (size_t)BCAST_CHUNK);
+				reqs.emplace_back();
+				MPI_Ibcast(buf + done, (int)one, MPI_BYTE, master(), WORLD, &reqs.back());
 			}
-			MPI_Bcast(buf, (int)len, MPI_BYTE, master(), WORLD);
-			if ( !is_m() ) {
-				data.reserve(len);
-				data.write(buf, len);
+			wait(reqs);
+		}
+
+		/* send holds every rank's part back to back, counts[k] bytes for
+		 * rank k (only meaningful on the master); recv gets this rank's part
+		 */
+		void scatter(const byte_array &send, const size_t counts[], byte_array &recv) {
+			uint64_t all[size()];
+			for (size_t k = 0; k < size() && counts != nullptr; ++k) {
+				all[k] = counts[k];
+			}
+			MPI_Bcast(all, (int)size(), MPI_UINT64_T, master(), WORLD);
+
+			uint64_t sdispls[size()];
+			size_t stotal = displs(all, sdispls);
+			byte *recvbuf = recv.grow(all[id()]);
+
+			if ( stotal <= MAX_COUNT ) {
+				int sendcounts[size()], sdispls_i[size()];
+				narrow(all, sendcounts);
+				narrow(sdispls, sdispls_i);
+				MPI_Scatterv((byte *)send.data(), sendcounts, sdispls_i, MPI_BYTE,
+						recvbuf, (int)all[id()], MPI_BYTE, master(), WORLD);
+				return;
 			}
+
+			collection<MPI_Request> reqs;
+			if ( is_m() ) {
+				for (size_t k = 0; k < size(); ++k) {
+					if ( (int)k == id() ) {
+						memcpy(recvbuf, send.data() + sdispls[k], all[k]);
+					} else if ( all[k] > 0 ) {
+						isend(send.data() + sdispls[k], all[k], (int)k, CHUNK_TAG, reqs);
+					}
+				}
+			} else if ( all[id()] > 0 ) {
+				irecv(recvbuf, all[id()], master(), CHUNK_TAG, reqs);
+			}
+			wait(reqs);
 		}
 
-		void scatter(const byte_array send[], byte_array &recv) {
-			int sendcounts[size()], sdispls[size()];
-			size_t stotal = 0;
+		/* send holds the parts for every rank back to back, counts[k] bytes
+		 * for rank k; everything received lands in recv, and views[k] is
+		 * set to a view of the part from rank k
+		 */
+		void alltoall(const byte_array &send, const size_t counts[],
+				byte_array &recv, byte_array views[]) {
+			uint64_t sendcounts[size()], sdispls[size()];
+			uint64_t recvcounts[size()], rdispls[size()];
 
-			for (size_t k = 0; k < size() && send != nullptr; ++k) {
-				sdispls[k] = (int)stotal;
-				sendcounts[k] = (int)send[k].size();
-				stotal += send[k].size();
+			for (size_t k = 0; k < size(); ++k) {
+				sendcounts[k] = counts[k];
 			}
+			MPI_Alltoall(sendcounts, 1, MPI_UINT64_T, recvcounts, 1, MPI_UINT64_T, WORLD);
+
+			size_t sendlen = displs(sendcounts, sdispls);
+			size_t recvlen = displs(recvcounts, rdispls);
 
-			int recvcount;
-			MPI_Scatter(sendcounts, 1, MPI_INT, &recvcount, 1, MPI_INT, master(), WORLD);
+			// every rank must take the same path
+			uint64_t local = std::max(sendlen, recvlen), largest;
+			MPI_Allreduce(&local, &largest, 1, MPI_UINT64_T, MPI_MAX, WORLD);
 
-			byte *sendbuf = new byte[stotal];
-			byte *recvbuf = new byte[recvcount];
-			for (size_t k = 0; k < size() && send != nullptr; ++k) {
-				memcpy(sendbuf + sdispls[k], send[k].data(), sendcounts[k]);
+			size_t base = recv.size();
+			byte *recvbuf = recv.grow(recvlen);
+
+			if ( largest <= MAX_COUNT ) {
+				int sendcounts_i[size()], sdispls_i[size()];
+				int recvcounts_i[size()], rdispls_i[size()];
+				narrow(sendcounts, sendcounts_i);
+				narrow(sdispls, sdispls_i);
+				narrow(recvcounts, recvcounts_i);
+				narrow(rdispls, rdispls_i);
+				MPI_Alltoallv((byte *)send.data(), sendcounts_i, sdispls_i, MPI_BYTE,
+						recvbuf, recvcounts_i, rdispls_i, MPI_BYTE, WORLD);
+			} else {
+				collection<MPI_Request> reqs;
+				for (size_t k = 0; k < size(); ++k) {
+					if ( (int)k != id() && recvcounts[k] > 0 ) {
+						irecv(recvbuf + rdispls[k], recvcounts[k], (int)k, CHUNK_TAG, reqs);
+					}
+				}
+				for (size_t k = 0; k < size(); ++k) {
+					if ( (int)k == id() ) {
+						memcpy(recvbuf + rdispls[k], send.data() + sdispls[k], sendcounts[k]);
+					} else if ( sendcounts[k] > 0 ) {
+						isend(send.data() + sdispls[k], sendcounts[k], (int)k, CHUNK_TAG, reqs);
+					}
+				}
+				wait(reqs);
 			}
-			MPI_Scatterv(sendbuf, sendcounts, sdispls, MPI_BYTE,
-					recvbuf, recvcount, MPI_BYTE, master(), WORLD);
 
-			recv.reserve(recvcount);
-			recv.write(recvbuf, recvcount);
+			for (size_t k = 0; k < size(); ++k) {
+				views[k] = recv.view(base + rdispls[k], recvcounts[k]);
+			}
+		}
+
+		// sends len bytes as messages of at most MAX_COUNT, at least one
+		void isend(const byte *buf, size_t len, int dest, int tag,
+				collection<MPI_Request> &reqs) {
+			do {
+				size_t one = std::min(len, (size_t)MAX_COUNT);
+				reqs.emplace_back();
+				MPI_Isend((byte *)buf, (int)one, MPI_BYTE, dest, tag, WORLD, &reqs.back());
+				buf += one;
+				len -= one;
+			} while ( len > 0 );
+		}
+
+		// the receiving side of isend
+		void irecv(byte *buf, size_t len, int source, int tag,
+				collection<MPI_Request> &reqs) {
+			do {
+				size_t one = std::min(len, (size_t)MAX_COUNT);
+				reqs.emplace_back();
+				MPI_Irecv(buf, (int)one, MPI_BYTE, source, tag, WORLD, &reqs.back());
+				buf += one;
+				len -= one;
+			} while ( len > 0 );
+		}
+
+		/* a message of any length: the length, then the bytes as by isend.
+		 * len holds data.size() and must live until reqs complete
+		 */
+		void isend_sized(const byte_array &data, const uint64_t &len, int dest, int tag,
+				collection<MPI_Request> &reqs) {
+			reqs.emplace_back();
+			MPI_Isend((uint64_t *)&len, 1, MPI_UINT64_T, dest, tag, WORLD, &reqs.back());
+			isend(data.data(), len, dest, tag, reqs);
+		}
+
+		// appends the message isend_sized sent from source to recv
+		void recv_sized(byte_array &recv, int source, int tag) {
+			uint64_t len;
+			MPI_Recv(&len, 1, MPI_UINT64_T, source, tag, WORLD, MPI_STATUS_IGNORE);
+			collection<MPI_Request> reqs;
+			irecv(recv.grow(len), len, source, tag, reqs);
+			wait(reqs);
+		}
+
+		void wait(collection<MPI_Request> &reqs) {
+			MPI_Waitall((int)reqs.size(), reqs.data(), MPI_STATUSES_IGNORE);
+			reqs.clear();
+		}
+
+		bool test(collection<MPI_Request> &reqs) {
+			int flag = 1;
+			if ( !reqs.empty() ) {
+				MPI_Testall((int)reqs.size(), reqs.data(), &flag, MPI_STATUSES_IGNORE);
+			}
+			if ( flag ) {
+				reqs.clear();
+			}
+			return flag != 0;
+		}
 
-			delete [] recvbuf;
-			delete [] sendbuf;
+		// appends the next message with tag to recv[source], returns its source
+		// or -1 if nothing has arrived and wait is false
+		int recv_any(int tag, byte_array recv[], size_t &len, bool wait) {
+			MPI_Status status;
+			int flag = 1;
+			if ( wait ) {
+				MPI_Probe(MPI_ANY_SOURCE, tag, WORLD, &status);
+			} else {
+				MPI_Iprobe(MPI_ANY_SOURCE, tag, WORLD, &flag, &status);
+			}
+			if ( !flag ) {
+				return -1;
+			}
+			int count, source = status.MPI_SOURCE;
+			MPI_Get_count(&status, MPI_BYTE, &count);
+			len = count;
+			MPI_Recv(recv[source].grow(len), count, MPI_BYTE,
+					source, tag, WORLD, MPI_STATUS_IGNORE);
+			return source;
 		}
 
-		void alltoall(const byte_array send[], byte_array recv[]) {
-			size_t sendlen = 0, recvlen = 0;
-			int sendcounts[size()], sdispls[size()];
-			int recvcounts[size()], rdispls[size()];
+		// on the master recv gets every rank's send, views[k] the one of rank k
+		void gather(const byte_array &send, byte_array &recv, byte_array views[]) {
+			uint64_t sendlen = send.size();
+			uint64_t recvcounts[size()], rdispls[size()];
+			MPI_Allgather(&sendlen, 1, MPI_UINT64_T, recvcounts, 1, MPI_UINT64_T, WORLD);
 
+			size_t rtotal = displs(recvcounts, rdispls);
+			size_t base = recv.size();
+			byte *recvbuf = is_m() ? recv.grow(rtotal) : nullptr;
+
+			if ( rtotal <= MAX_COUNT ) {
+				int recvcounts_i[size()], rdispls_i[size()];
+				narrow(recvcounts, recvcounts_i);
+				narrow(rdispls, rdispls_i);
+				MPI_Gatherv((byte *)send.data(), (int)sendlen, MPI_BYTE,
+						recvbuf, recvcounts_i, rdispls_i, MPI_BYTE, master(), WORLD);
+			} else {
+				collection<MPI_Request> reqs;
+				if ( is_m() ) {
+					for (size_t k = 0; k < size(); ++k) {
+						if ( (int)k == id() ) {
+							memcpy(recvbuf + rdispls[k], send.data(), sendlen);
+						} else if ( recvcounts[k] > 0 ) {
+							irecv(recvbuf + rdispls[k], recvcounts[k], (int)k, CHUNK_TAG, reqs);
+						}
+					}
+				} else if ( sendlen > 0 ) {
+					isend(send.data(), sendlen, master(), CHUNK_TAG, reqs);
+				}
+				wait(reqs);
+			}
+
+			for (size_t k = 0; k < size() && views != nullptr; ++k) {
+				views[k] = recv.view(base + rdispls[k], recvcounts[k]);
+			}
+		}
+
+		// every rank appends the sends of all ranks, in rank order, to recv
+		void allgather(const byte_array &send, byte_array &recv) {
+			uint64_t sendlen = send.size();
+			uint64_t recvcounts[size()], rdispls[size()];
+			MPI_Allgather(&sendlen, 1, MPI_UINT64_T, recvcounts, 1, MPI_UINT64_T, WORLD);
+
+			size_t rtotal = displs(recvcounts, rdispls);
+			byte *recvbuf = recv.grow(rtotal);
+
+			if ( rtotal <= MAX_COUNT ) {
+				int recvcounts_i[size()], rdispls_i[size()];
+				narrow(recvcounts, recvcounts_i);
+				narrow(rdispls, rdispls_i);
+				MPI_Allgatherv((byte *)send.data(), (int)sendlen, MPI_BYTE,
+						recvbuf, recvcounts_i, rdispls_i, MPI_BYTE, WORLD);
+				return;
+			}
+
+			collection<MPI_Request> reqs;
 			for (size_t k = 0; k < size(); ++k) {
-				sdispls[k] = (int)sendlen;
-				sendcounts[k] = (int)send[k].size();
-				sendlen += send[k].size();
+				if ( (int)k == id() ) {
+					memcpy(recvbuf + rdispls[k], send.data(), sendlen);
+				} else if ( recvcounts[k] > 0 ) {
+					irecv(recvbuf + rdispls[k], recvcounts[k], (int)k, CHUNK_TAG, reqs);
+				}
 			}
-			MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, WORLD);
+			for (size_t k = 0; k < size() && sendlen > 0; ++k) {
+				if ( (int)k != id() ) {
+					isend(send.data(), sendlen, (int)k, CHUNK_TAG, reqs);
+				}
+			}
+			wait(reqs);
+		}
+
+		/* groups the ranks into nodes: ranks_per_node consecutive ranks
+		 * each, or when it is 0 the ranks sharing memory. collective
+		 */
+		void set_nodes(size_t ranks_per_node) {
+			if ( nodes_for == ranks_per_node ) {
+				return;
+			}
+			nodes_for = ranks_per_node;
+			leader_of.resize(size());
+			if ( ranks_per_node > 0 ) {
+				for (size_t k = 0; k < size(); ++k) {
+					leader_of[k] = (int)(k - k % ranks_per_node);
+				}
+				return;
+			}
+			MPI_Comm node;
+			MPI_Comm_split_type(WORLD, MPI_COMM_TYPE_SHARED, id(), MPI_INFO_NULL, &node);
+			int leader = id();
+			MPI_Allreduce(MPI_IN_PLACE, &leader, 1, MPI_INT, MPI_MIN, node);
+			MPI_Comm_free(&node);
+			MPI_Allgather(&leader, 1, MPI_INT, leader_of.data(), 1, MPI_INT, WORLD);
+		}
+
+		/* alltoall through the nodes of set_nodes: every rank hands its
+		 * parts to the leader of its node, the leaders swap what goes from
+		 * node to node, and hand each rank what its node got for it. a
+		 * leader calls merge once, on what the ranks of its node send each
+		 * rank, before it goes to the other leaders; merge may rewrite the
+		 * parts. views[k] is set to what came through the leader k
+		 */
+		void node_alltoall(const byte_array &send, const size_t counts[],
+				byte_array &recv, byte_array views[],
+				const std::function<void(collection<byte_array> &)> &merge) {
+			int leader = leader_of[id()];
+			collection<MPI_Request> reqs;
 
+			// up: counts, then the parts
+			byte_array up;
 			for (size_t k = 0; k < size(); ++k) {
-				rdispls[k] = (int)recvlen;
-				recvlen += recvcounts[k];
+				up.write((uint64_t)counts[k]);
 			}
+			up.write(send.data(), send.size());
+			uint64_t uplen = up.size();
+			if ( leader != id() ) {
+				isend_sized(up, uplen, leader, NODE_UP_TAG, reqs);
+				wait(reqs);
 
-			byte *sendbuf = new byte [sendlen];
-			byte *recvbuf = new byte [recvlen];
+				// down: a count per leader, then the parts
+				byte_array down;
+				recv_sized(down, leader, NODE_DOWN_TAG);
+				place(down, recv, views);
+				return;
+			}
+
+			collection<byte_array> parts(size());
+			for (size_t j = 0; j < size(); ++j) {
+				if ( leader_of[j] != id() ) {
+					continue;
+				}
+				byte_array from;
+				if ( (int)j == id() ) {
+					from = up.view();
+				} else {
+					recv_sized(from, (int)j, NODE_UP_TAG);
+				}
+				collection<uint64_t> lens(size());
+				for (size_t k = 0; k < size(); ++k) {
+					lens[k] = from.read<uint64_t>();
+				}
+				for (size_t k = 0; k < size(); ++k) {
+					parts[k].write(from.read(lens[k]), lens[k]);
+				}
+			}
+			merge(parts);
+
+			// across: to every leader, a count per rank of its node, then the parts
+			collection<byte_array> across(size());
+			collection<uint64_t> acrosslen(size());
 			for (size_t k = 0; k < size(); ++k) {
-				memcpy(sendbuf + sdispls[k], send[k].data(), sendcounts[k]);
+				across[leader_of[k]].write((uint64_t)parts[k].size());
 			}
-			MPI_Alltoallv(sendbuf, sendcounts, sdispls, MPI_BYTE,
-					recvbuf, recvcounts, rdispls, MPI_BYTE, WORLD);
 			for (size_t k = 0; k < size(); ++k) {
-				recv[k].reserve(recvcounts[k]);
-				recv[k].write(recvbuf + rdispls[k], recvcounts[k]);
+				across[leader_of[k]].write(parts[k].data(), parts[k].size());
+				parts[k].clear();
+			}
+			for (size_t n = 0; n < size(); ++n) {
+				if ( leader_of[n] == (int)n && (int)n != id() ) {
+					acrosslen[n] = across[n].size();
+					isend_sized(across[n], acrosslen[n], (int)n, NODE_ACROSS_TAG, reqs);
+				}
+			}
+
+			// what the leaders send this node, kept by leader and rank
+			collection<collection<byte_array>> got(size());
+			for (size_t n = 0; n < size(); ++n) {
+				if ( leader_of[n] != (int)n ) {
+					continue;
+				}
+				byte_array from;
+				if ( (int)n == id() ) {
+					from = std::move(across[n]);
+				} else {
+					recv_sized(from, (int)n, NODE_ACROSS_TAG);
+				}
+				collection<uint64_t> lens(size());
+				for (size_t j = 0; j < size(); ++j) {
+					lens[j] = leader_of[j] == id() ? from.read<uint64_t>() : 0;
+				}
+				got[n].resize(size());
+				for (size_t j = 0; j < size(); ++j) {
+					got[n][j].write(from.read(lens[j]), lens[j]);
+				}
+			}
+			wait(reqs);
+
+			collection<byte_array> downs(size());
+			collection<uint64_t> downlen(size());
+			for (size_t j = 0; j < size(); ++j) {
+				if ( leader_of[j] != id() ) {
+					continue;
+				}
+				for (size_t n = 0; n < size(); ++n) {
+					downs[j].write((uint64_t)(got[n].empty() ? 0 : got[n][j].size()));
+				}
+				for (size_t n = 0; n < size(); ++n) {
+					if ( !got[n].empty() ) {
+						downs[j].write(got[n][j].data(), got[n][j].size());
+						got[n][j].clear();
+					}
+				}
+				if ( (int)j != id() ) {
+					downlen[j] = downs[j].size();
+					isend_sized(downs[j], downlen[j], (int)j, NODE_DOWN_TAG, reqs);
+				}
 			}
-			delete [] recvbuf;
-			delete [] sendbuf;
+			place(downs[id()], recv, views);
+			wait(reqs);
 		}
 
-		void gather(const byte_array &send, byte_array recv[]) {
-			int sendlen = (int)send.size();
-			int recvcounts[size()];
-			MPI_Gather(&sendlen, 1, MPI_INT, recvcounts, 1, MPI_INT, master(), WORLD);
+		size_t sum(size_t v) {
+			uint64_t local = v, total;
+			MPI_Allreduce(&local, &total, 1, MPI_UINT64_T, MPI_SUM, WORLD);
+			return total;
+		}
 
-			int rdispls[size()];
-			size_t rtotal = 0;
-			for (size_t k = 0; k < size() && recv != nullptr; ++k) {
-				rdispls[k] = (int)rtotal;
-				rtotal += recvcounts[k];
+		size_t max(size_t v) {
+			uint64_t local = v, largest;
+			MPI_Allreduce(&local, &largest, 1, MPI_UINT64_T, MPI_MAX, WORLD);
+			return largest;
+		}
+
+		// ends every rank, for errors a job cannot go on from
+		void abort(const char *why) const {
+			fprintf(stderr, "rank %d: %s\n", id(), why);
+			MPI_Abort(WORLD, 1);
+		}
+
+	private:
+		// appends the parts of a message of counts and parts to recv
+		void place(byte_array &msg, byte_array &recv, byte_array views[]) {
+			collection<uint64_t> lens(size());
+			for (size_t k = 0; k < size(); ++k) {
+				lens[k] = msg.read<uint64_t>();
 			}
+			size_t base = recv.size();
+			size_t rest = msg.remain();
+			memcpy(recv.grow(rest), msg.read(rest), rest);
+			for (size_t k = 0; k < size(); ++k) {
+				views[k] = recv.view(base, lens[k]);
+				base += lens[k];
+			}
+		}
 
-			byte *recvbuf = new byte[rtotal];
-			MPI_Gatherv((byte *)send.data(), (int)send.size(), MPI_BYTE,
-					recvbuf, recvcounts, rdispls, MPI_BYTE, master(), WORLD);
+		// fills displacements for counts, returns the total
+		size_t displs(const uint64_t counts[], uint64_t displs[]) const {
+			size_t total = 0;
+			for (size_t k = 0; k < size(); ++k) {
+				displs[k] = total;
+				total += counts[k];
+			}
+			return total;
+		}
 
-			for (size_t k = 0; k < size() && recv != nullptr; ++k) {
-				recv[k].reserve(recvcounts[k]);
-				recv[k].write(recvbuf + rdispls[k], recvcounts[k]);
+		// only called once the total is known to fit
+		void narrow(const uint64_t from[], int to[]) const {
+			for (size_t k = 0; k < size(); ++k) {
+				to[k] = (int)from[k];
 			}
-			delete [] recvbuf;
 		}
 	};
 }
@@ -0,0 +1,138 @@
+
+#ifndef _ARES_PROFILE_HPP_
+#define _ARES_PROFILE_HPP_
+
+#include "bytes.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace ares_impl {
+
+	enum class phase {
+		scatter, map, combine, serialize, alltoall, group, reduce, gather, count
+	};
+
+	/* what one rank spent on a job: wall time per phase, record counts
+	 * and shuffle bytes per peer. time spent serializing pipelined rounds
+	 * while mapping counts as map time.
+	 */
+	class profiler {
+	public:
+		static constexpr size_t PHASES = (size_t)phase::count;
+
+		double seconds[PHASES];
+		uint64_t records, pairs, results;
+		collection<uint64_t> sent, received;
+
+		// adds the lifetime of the scope to phase p
+		class scope {
+			double &total;
+			std::chrono::steady_clock::time_point start;
+		public:
+			scope(profiler &prof, phase p): total(prof.seconds[(size_t)p]),
+					start(std::chrono::steady_clock::now()) {}
+			scope(const scope &) = delete;
+			~scope() {
+				std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+				total += d.count();
+			}
+		};
+
+		profiler() = default;
+		profiler(profiler &&) = default;
+		profiler &operator=(profiler &&) = default;
+
+		explicit profiler(size_t peers) { clear(peers); }
+
+		profiler(byte_array &bs) {
+			for (double &s : seconds) {
+				s = bs.read<double>();
+			}
+			records = bs.read<uint64_t>();
+			pairs = bs.read<uint64_t>();
+			results = bs.read<uint64_t>();
+			sent = bs.read<collection<uint64_t>>();
+			received = bs.read<collection<uint64_t>>();
+		}
+
+		void write_to(byte_array &bs) const {
+			for (double s : seconds) {
+				bs.write(s);
+			}
+			bs.write(records);
+			bs.write(pairs);
+			bs.write(results);
+			bs.write(sent);
+			bs.write(received);
+		}
+
+		void clear(size_t peers) {
+			std::fill(seconds, seconds + PHASES, 0.0);
+			records = pairs = results = 0;
+			sent.assign(peers, 0);
+			received.assign(peers, 0);
+		}
+	};
+
+	/* one line of json per job, each value as min / max / mean over the
+	 * ranks, plus the full matrices of bytes sent and received per peer
+	 */
+	inline std::string profile_json(size_t job, const profiler ranks[], size_t n) {
+		static const char *names[profiler::PHASES] = {
+			"scatter", "map", "combine", "serialize",
+			"alltoall", "group", "reduce", "gather"
+		};
+		std::string out;
+		char buf[128];
+
+		auto stat = [&](const char *name, double (*get)(const profiler &, size_t), size_t i) {
+			double lo = get(ranks[0], i), hi = lo, sum = 0;
+			for (size_t k = 0; k < n; ++k) {
+				double v = get(ranks[k], i);
+				lo = std::min(lo, v);
+				hi = std::max(hi, v);
+				sum += v;
+			}
+			snprintf(buf, sizeof(buf), "\"%s\":{\"min\":%.9g,\"max\":%.9g,\"mean\":%.9g}",
+					name, lo, hi, sum / n);
+			out += buf;
+		};
+		auto matrix = [&](const char *name, collection<uint64_t> profiler::*field) {
+			out += std::string("\"") + name + "\":[";
+			for (size_t k = 0; k < n; ++k) {
+				out += k ? ",[" : "[";
+				const collection<uint64_t> &row = ranks[k].*field;
+				for (size_t j = 0; j < row.size(); ++j) {
+					out += (j ? "," : "") + std::to_string(row[j]);
+				}
+				out += "]";
+			}
+			out += "]";
+		};
+
+		snprintf(buf, sizeof(buf), "{\"job\":%zu,\"ranks\":%zu,\"seconds\":{", job, n);
+		out += buf;
+		for (size_t i = 0; i < profiler::PHASES; ++i) {
+			out += i ? "," : "";
+			stat(names[i], [](const profiler &p, size_t i) { return p.seconds[i]; }, i);
+		}
+		out += "},";
+		stat("records", [](const profiler &p, size_t) { return (double)p.records; }, 0);
+		out += ",";
+		stat("pairs", [](const profiler &p, size_t) { return (double)p.pairs; }, 0);
+		out += ",";
+		stat("results", [](const profiler &p, size_t) { return (double)p.results; }, 0);
+		out += ",";
+		matrix("bytes_sent", &profiler::sent);
+		out += ",";
+		matrix("bytes_received", &profiler::received);
+		out += "}";
+		return out;
+	}
+
+}
+
+#endif // _ARES_PROFILE_HPP_
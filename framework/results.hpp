@@ -0,0 +1,278 @@
+
+#ifndef _ARES_RESULTS_HPP_
+#define _ARES_RESULTS_HPP_
+
+#include "bytes.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace ares_impl {
+
+	/* job results that never meet in one place: each rank writes its own
+	 * part to a file and the master only learns where the parts are, or
+	 * the master reads the results a part at a time instead of copying
+	 * them into one collection.
+	 */
+	enum class result_format {
+		binary,	// the serialized collection of results, as gathered
+		text	// a line per result, see text_of
+	};
+
+	struct result_part {
+		std::string path;
+		size_t count;
+		uint64_t bytes;
+		result_format format;	// as written, binary for types without text
+	};
+
+	// the parts of run_to_files, in rank order
+	struct result_manifest {
+		collection<result_part> parts;
+		size_t total = 0;
+		bool complete = true;	// false if a rank could not write its part
+	};
+
+	/* the text form of a result: numbers, strings, pairs as key tab value,
+	 * and collections as values split by spaces. known is false for any
+	 * other type, whose results are written in binary instead
+	 */
+	template <typename T, typename = void> struct text_of {
+		static constexpr bool known = false;
+	};
+
+	template <typename T>
+	struct text_of<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+		static constexpr bool known = true;
+		static void put(std::string &out, T v) { out += std::to_string(v); }
+	};
+
+	template <typename T>
+	struct text_of<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+		static constexpr bool known = true;
+		static void put(std::string &out, T v) {
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%.*g", std::numeric_limits<double>::max_digits10, (double)v);
+			out += buf;
+		}
+	};
+
+	template <> struct text_of<std::string> {
+		static constexpr bool known = true;
+		static void put(std::string &out, const std::string &s) { out += s; }
+	};
+
+	template <typename K, typename V> struct text_of<pair<K, V>> {
+		static constexpr bool known = text_of<K>::known && text_of<V>::known;
+		static void put(std::string &out, const pair<K, V> &p) {
+			text_of<K>::put(out, p.first);
+			out += '\t';
+			text_of<V>::put(out, p.second);
+		}
+	};
+
+	template <typename T> struct text_of<collection<T>> {
+		static constexpr bool known = text_of<T>::known;
+		static void put(std::string &out, const collection<T> &cc) {
+			for (size_t i = 0; i < cc.size(); ++i) {
+				if ( i > 0 ) {
+					out += ' ';
+				}
+				text_of<T>::put(out, cc[i]);
+			}
+		}
+	};
+
+	// a line per result, written in blocks
+	template <typename T> bool write_text(byte_array &results, FILE *out, std::true_type) {
+		static constexpr size_t BLOCK = 256 << 10;
+		std::string lines;
+		bool ok = true;
+		for (size_t n = results.read<size_t>(); n > 0 && ok; --n) {
+			text_of<T>::put(lines, results.read<T>());
+			lines += '\n';
+			if ( lines.size() >= BLOCK || n == 1 ) {
+				ok = fwrite(lines.data(), 1, lines.size(), out) == lines.size();
+				lines.clear();
+			}
+		}
+		return ok;
+	}
+
+	template <typename T> bool write_text(byte_array &, FILE *, std::false_type) {
+		return false;
+	}
+
+	/* writes a rank's serialized results to part.path in format and fills
+	 * in the rest of part, returns false when the file cannot be written
+	 */
+	template <typename T> bool write_part(byte_array &results, result_format format, result_part &part) {
+		const std::string &path = part.path;
+		part.count = 0;
+		part.bytes = 0;
+		part.format = format == result_format::text && text_of<T>::known ?
+				result_format::text : result_format::binary;
+		FILE *out = fopen(path.c_str(), "wb");
+		if ( out == nullptr ) {
+			fprintf(stderr, "cannot open result file %s\n", path.c_str());
+			return false;
+		}
+		part.count = results.read<size_t>();
+		results.reset();
+		bool ok;
+		if ( part.format == result_format::text ) {
+			ok = write_text<T>(results, out, std::integral_constant<bool, text_of<T>::known>());
+		} else {
+			if ( format == result_format::text ) {
+				fprintf(stderr, "results have no text form, %s is binary\n", path.c_str());
+			}
+			ok = fwrite(results.data(), 1, results.size(), out) == results.size();
+		}
+		part.bytes = (uint64_t)ftello(out);
+		ok = fclose(out) == 0 && ok;
+		if ( !ok ) {
+			fprintf(stderr, "cannot write result file %s\n", path.c_str());
+		}
+		return ok;
+	}
+
+	/* the results of a job, deserialized one at a time as they are walked
+	 * through, a part at a time: fetched from the rank holding it, or read
+	 * from the binary files of a manifest. an input range, walked once
+	 */
+	template <typename T> class result_stream {
+	public:
+		/* fetch(k, out) puts part k in out, fetch(parts, out) lets the
+		 * parts not fetched go
+		 */
+		typedef std::function<void(size_t, byte_array &)> fetch_t;
+
+	private:
+		std::shared_ptr<fetch_t> fetch;
+		size_t parts = 0;
+		collection<std::string> paths;
+		size_t next_part = 0;
+
+		byte_array cur;
+		size_t left = 0;
+
+	public:
+		class iterator {
+			result_stream *s;
+			T v;
+
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef T value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef T *pointer;
+			typedef T &reference;
+
+			explicit iterator(result_stream *s): s(s) { ++*this; }
+			iterator(): s(nullptr) {}
+
+			T &operator*() { return v; }
+			T *operator->() { return &v; }
+			iterator &operator++() {
+				if ( s != nullptr && !s->next(v) ) {
+					s = nullptr;
+				}
+				return *this;
+			}
+			bool operator==(const iterator &o) const { return s == o.s; }
+			bool operator!=(const iterator &o) const { return s != o.s; }
+		};
+
+		result_stream() = default;
+		result_stream(result_stream &&) = default;
+
+		result_stream &operator=(result_stream &&o) {
+			if ( this != &o ) {
+				close();
+				fetch = std::move(o.fetch);
+				parts = o.parts;
+				paths = std::move(o.paths);
+				next_part = o.next_part;
+				cur = std::move(o.cur);
+				left = o.left;
+			}
+			return *this;
+		}
+
+		~result_stream() { close(); }
+
+		result_stream(size_t parts, fetch_t fetch):
+				fetch(std::make_shared<fetch_t>(std::move(fetch))), parts(parts) {}
+
+		// text parts cannot be read back, a manifest with any reads nothing
+		explicit result_stream(const result_manifest &manifest) {
+			for (const result_part &p : manifest.parts) {
+				if ( p.format != result_format::binary ) {
+					fprintf(stderr, "%s is text, only binary results can be read back\n", p.path.c_str());
+					paths.clear();
+					return;
+				}
+				paths.push_back(p.path);
+			}
+		}
+
+		// the next result, false once they are all read
+		bool next(T &v) {
+			while ( left == 0 ) {
+				if ( !load() ) {
+					return false;
+				}
+			}
+			--left;
+			v = cur.read<T>();
+			return true;
+		}
+
+		iterator begin() { return iterator(this); }
+		iterator end() { return iterator(); }
+
+	private:
+		// moves on to the next part, dropping the one read
+		bool load() {
+			cur.clear();
+			if ( fetch != nullptr && next_part < parts ) {
+				(*fetch)(next_part++, cur);
+			} else if ( fetch == nullptr && next_part < paths.size() ) {
+				const std::string &path = paths[next_part++];
+				FILE *in = fopen(path.c_str(), "rb");
+				bool ok = in != nullptr && fseeko(in, 0, SEEK_END) == 0;
+				off_t len = ok ? ftello(in) : 0;
+				ok = ok && fseeko(in, 0, SEEK_SET) == 0 &&
+						fread(cur.grow(len), 1, len, in) == (size_t)len;
+				if ( in != nullptr ) {
+					fclose(in);
+				}
+				if ( !ok ) {
+					fprintf(stderr, "cannot read result file %s\n", path.c_str());
+					cur.clear();
+				}
+			} else {
+				return false;
+			}
+			left = cur.remain() >= sizeof(size_t) ? cur.read<size_t>() : 0;
+			return true;
+		}
+
+		// lets the parts not fetched go
+		void close() {
+			if ( fetch != nullptr && next_part < parts ) {
+				(*fetch)(parts, cur);
+			}
+			fetch.reset();
+		}
+	};
+
+}
+
+#endif // _ARES_RESULTS_HPP_
@@ -0,0 +1,150 @@
+
+#ifndef _ARES_SHUFFLE_HPP_
+#define _ARES_SHUFFLE_HPP_
+
+#include "mpi.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace ares_impl {
+
+	/* pipelined shuffle: map output is sent in rounds of per-destination
+	 * buffers while mapping goes on, instead of one alltoall at the end.
+	 *
+	 * a round is a byte_array[size], one serialized pair collection per
+	 * destination. any thread may post a round, only the thread owning MPI
+	 * sends and receives (pump/finish). at most one round is in flight and
+	 * at most `limit` rounds wait in the queue, which bounds the memory.
+	 *
+	 * rounds from a peer are appended to recv[peer] in arrival order (large
+	 * rounds arrive as several messages), so recv[k] holds several
+	 * collections back to back. an empty message
+	 * marks the end of a peer's data; jobs alternate between two tags so
+	 * that a peer already in the next job cannot be mistaken for this one.
+	 */
+	class shuffle {
+		static constexpr int TAG = 0x5a00;
+
+		mpi_controller &mpi;
+		size_t size;
+		int tag;
+		size_t limit;
+
+		std::mutex lock;
+		std::condition_variable ready;
+		std::deque<byte_array *> queue;
+
+		byte_array *sending = nullptr;
+		collection<MPI_Request> reqs;
+		size_t ended = 0;
+
+	public:
+		byte_array *recv;
+
+		// bytes sent to each peer so far
+		collection<uint64_t> sent;
+
+		shuffle(mpi_controller &mpi, size_t seq, size_t limit):
+				mpi(mpi), size(mpi.size()), tag(TAG + (int)(seq & 1)),
+				limit(std::max<size_t>(1, limit)), sent(size, 0) {
+			recv = new byte_array[size];
+		}
+
+		~shuffle() {
+			delete [] sending;
+			delete [] recv;
+		}
+
+		// takes ownership of round; other threads block while the queue is full
+		void post(byte_array *round, bool mpi_thread) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				if ( !mpi_thread ) {
+					ready.wait(guard, [this] { return queue.size() < limit; });
+				}
+				queue.push_back(round);
+			}
+			if ( mpi_thread ) {
+				pump();
+			}
+		}
+
+		// MPI thread only: sends queued rounds and receives what has arrived
+		void pump() {
+			while ( true ) {
+				byte_array *round;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					if ( queue.empty() ) {
+						break;
+					}
+					round = queue.front();
+					queue.pop_front();
+				}
+				ready.notify_all();
+				send(round);
+			}
+			poll(false);
+		}
+
+		// MPI thread only: sends the rest, then waits for every peer's end mark
+		void finish() {
+			pump();
+			wait_sent();
+
+			for (size_t k = 0; k < size; ++k) {
+				if ( (int)k != mpi.id() ) {
+					mpi.isend(nullptr, 0, (int)k, tag, reqs);
+				}
+			}
+			while ( ended + 1 < size ) {
+				poll(true);
+			}
+			wait_sent();
+		}
+
+	private:
+		void send(byte_array *round) {
+			wait_sent();
+			for (size_t k = 0; k < size; ++k) {
+				if ( round[k].size() == 0 ) {
+					continue;
+				}
+				sent[k] += round[k].size();
+				if ( (int)k == mpi.id() && recv[k].size() == 0 ) {
+					recv[k] = std::move(round[k]);
+				} else if ( (int)k == mpi.id() ) {
+					memcpy(recv[k].grow(round[k].size()), round[k].data(), round[k].size());
+				} else {
+					mpi.isend(round[k].data(), round[k].size(), (int)k, tag, reqs);
+				}
+			}
+			sending = round;
+		}
+
+		void wait_sent() {
+			while ( !mpi.test(reqs) ) {
+				poll(false);
+			}
+			delete [] sending;
+			sending = nullptr;
+		}
+
+		void poll(bool wait) {
+			size_t len;
+			while ( mpi.recv_any(tag, recv, len, wait) >= 0 ) {
+				if ( len == 0 ) {
+					++ended;
+				}
+				if ( wait ) {
+					break;
+				}
+			}
+		}
+	};
+
+}
+
+#endif // _ARES_SHUFFLE_HPP_
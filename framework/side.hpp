@@ -0,0 +1,109 @@
+
+#ifndef _ARES_SIDE_HPP_
+#define _ARES_SIDE_HPP_
+
+#include "bytes.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <typeinfo>
+
+namespace ares_impl {
+
+	/* the side data of a stage, as the serialized bytes every rank holds
+	 * the same, and the value setup takes, deserialized once per version
+	 * rather than once per setup.
+	 *
+	 * every rank bumps version on the same changes: the master sends
+	 * nothing when the data set is what the ranks hold, only the blocks of
+	 * BLOCK bytes that differ when few do, and the whole of it otherwise.
+	 */
+	class side_data {
+		std::mutex lock;
+		std::shared_ptr<const void> value;
+		const std::type_info *type = nullptr;
+		uint64_t value_version = 0;
+
+	public:
+		static constexpr size_t BLOCK = 4 << 10;
+
+		byte_array bytes;
+		uint64_t version = 0;
+
+		// bytes were replaced, the value deserialized from the old ones goes
+		void changed() {
+			std::lock_guard<std::mutex> guard(lock);
+			++version;
+			value.reset();
+		}
+
+		void replace(byte_array &&to) {
+			bytes = std::move(to);
+			changed();
+		}
+
+		/* the value of bytes as a V, deserialized the first time it is
+		 * asked for after a change; safe to call from map threads
+		 */
+		template <typename V> std::shared_ptr<const V> get() {
+			std::lock_guard<std::mutex> guard(lock);
+			if ( value == nullptr || type != &typeid(V) || value_version != version ) {
+				bytes.reset();
+				value = std::make_shared<const V>(bytes.read<V>());
+				bytes.reset();
+				type = &typeid(V);
+				value_version = version;
+			}
+			return std::static_pointer_cast<const V>(value);
+		}
+
+		bool same(const byte_array &to) const {
+			return to.size() == bytes.size() && memcmp(to.data(), bytes.data(), to.size()) == 0;
+		}
+
+		// the blocks of to that differ from bytes, every one past its end
+		collection<uint64_t> changed_blocks(const byte_array &to) const {
+			collection<uint64_t> blocks;
+			for (size_t at = 0; at < to.size(); at += BLOCK) {
+				size_t len = std::min((size_t)BLOCK, to.size() - at);
+				if ( at + len > bytes.size() ||
+						memcmp(to.data() + at, bytes.data() + at, len) != 0 ) {
+					blocks.push_back(at / BLOCK);
+				}
+			}
+			return blocks;
+		}
+
+		// the blocks of to, back to back
+		static byte_array pick(const byte_array &to, const collection<uint64_t> &blocks) {
+			byte_array picked;
+			for (uint64_t b : blocks) {
+				size_t at = b * BLOCK;
+				picked.write(to.data() + at, std::min((size_t)BLOCK, to.size() - at));
+			}
+			return picked;
+		}
+
+		// bytes become size bytes, blocks of them taken from picked
+		void patch(size_t size, const collection<uint64_t> &blocks, byte_array &picked) {
+			byte_array to;
+			size_t same = std::min(size, bytes.size());
+			byte *p = to.grow(size);
+			if ( same > 0 ) {
+				memcpy(p, bytes.data(), same);
+			}
+			for (uint64_t b : blocks) {
+				size_t at = b * BLOCK;
+				size_t len = std::min((size_t)BLOCK, size - at);
+				memcpy(p + at, picked.read(len), len);
+			}
+			replace(std::move(to));
+		}
+	};
+
+}
+
+#endif // _ARES_SIDE_HPP_
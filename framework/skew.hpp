@@ -0,0 +1,67 @@
+
+#ifndef _ARES_SKEW_HPP_
+#define _ARES_SKEW_HPP_
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace ares_impl {
+
+	/* hot key detection for skew-aware partitioning. the first `limit`
+	 * pairs a map thread emits are counted; a key holding more than a
+	 * 1/size share of them is then spread round-robin over as many ranks
+	 * as its share warrants, starting at its home rank. the rank of a
+	 * spread pair only combines it and forwards the partial result home.
+	 */
+	template <typename K> class key_sampler {
+		size_t limit, size;
+		size_t sampled = 0, spin = 0;
+		bool decided = false;
+
+		// key counts while sampling, then the spread of each hot key
+		std::unordered_map<K, size_t> counts;
+
+	public:
+		key_sampler(size_t limit, size_t size): limit(limit), size(size) {}
+
+		void count(const K &key) {
+			if ( decided || limit == 0 ) {
+				return;
+			}
+			++counts[key];
+			if ( ++sampled == limit ) {
+				decide();
+			}
+		}
+
+		size_t target(const K &key, size_t home) {
+			if ( counts.empty() || !decided ) {
+				return home;
+			}
+			auto it = counts.find(key);
+			if ( it == counts.end() ) {
+				return home;
+			}
+			return (home + spin++ % it->second) % size;
+		}
+
+	private:
+		void decide() {
+			for (auto it = counts.begin(); it != counts.end(); ) {
+				size_t spread = std::min(size, it->second * size / sampled + 1);
+				if ( spread > 1 ) {
+					it->second = spread;
+					++it;
+				} else {
+					it = counts.erase(it);
+				}
+			}
+			decided = true;
+		}
+	};
+
+}
+
+#endif // _ARES_SKEW_HPP_
@@ -0,0 +1,218 @@
+
+#ifndef _ARES_SPILL_HPP_
+#define _ARES_SPILL_HPP_
+
+#include "bytes.hpp"
+#include "compress.hpp"
+#include "group.hpp"
+#include "mpi.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <queue>
+
+namespace ares_impl {
+
+	/* out-of-core shuffle: map output past the memory budget is written to
+	 * temp files as sorted runs, the runs are shuffled one per destination
+	 * at a time, and reduce merges the runs it received from disk.
+	 *
+	 * a run holds pairs in group::sort_key order, as blocks of
+	 *
+	 *   uint64 bytes, serialized collection of pairs (lz blocks with compress)
+	 *
+	 * so a merge needs one block of every run in memory.
+	 */
+	namespace spill {
+
+		static constexpr size_t BLOCK = 256 << 10;
+
+		// an unnamed temp file, removed when closed
+		class file {
+			FILE *f;
+			uint64_t end = 0;
+
+		public:
+			file(): f(tmpfile()) {
+				if ( f == nullptr ) {
+					fprintf(stderr, "cannot create spill file\n");
+				}
+			}
+
+			file(const file &) = delete;
+			file &operator=(const file &) = delete;
+
+			~file() {
+				if ( f != nullptr ) {
+					fclose(f);
+				}
+			}
+
+			// appends data, returns where it starts
+			uint64_t append(const byte_array &data) {
+				uint64_t at = end;
+				if ( f == nullptr || fseeko(f, end, SEEK_SET) != 0 ||
+						fwrite(data.data(), 1, data.size(), f) != data.size() ) {
+					fprintf(stderr, "cannot write spill file\n");
+				}
+				end += data.size();
+				return at;
+			}
+
+			// appends len bytes from at to out
+			void read(uint64_t at, size_t len, byte_array &out) {
+				byte *p = out.grow(len);
+				if ( f == nullptr || fseeko(f, at, SEEK_SET) != 0 || fread(p, 1, len, f) != len ) {
+					fprintf(stderr, "cannot read spill file\n");
+				}
+			}
+		};
+
+		struct run {
+			file *in;
+			uint64_t offset, bytes;
+		};
+
+		// the files and runs of a job
+		struct store {
+			std::deque<file> files;
+			collection<collection<run>> runs;
+
+			run append(file &f, const byte_array &data) {
+				return run{ &f, f.append(data), data.size() };
+			}
+		};
+
+		/* sorts pairs and writes them as a run to out, empties pairs */
+		template <typename K, typename V>
+		void write_run(collection<pair<K, V>> &pairs, byte_array &out, bool compress) {
+			int bytes = 0;
+			collection<group::item_t> items(pairs.size());
+			for (size_t i = 0; i < pairs.size(); ++i) {
+				items[i] = make_pair(group::sort_key(pairs[i].first, bytes), i);
+			}
+			if ( !items.empty() ) {
+				group::radix_sort(items, bytes);
+			}
+
+			collection<pair<K, V>> part;
+			byte_array block, packed;
+			for (size_t i = 0; i < items.size(); ) {
+				size_t used = 0;
+				while ( i < items.size() && used < BLOCK ) {
+					pair<K, V> &p = pairs[items[i++].second];
+					used += wire_size(p);
+					part.push_back(std::move(p));
+				}
+				block.write(part);
+				part.clear();
+
+				if ( compress ) {
+					lz::encode(block.data(), block.size(), packed);
+					std::swap(block, packed);
+					packed.clear();
+				}
+				out.write((uint64_t)block.size());
+				out.write(block.data(), block.size());
+				block.clear();
+			}
+			pairs.clear();
+		}
+
+		/* a k-way merge of runs of pairs, handing out every key with all
+		 * its values in sort key order
+		 */
+		template <typename K, typename V> class merger {
+			typedef collection<pair<K, V>> pair_cc_t;
+
+			struct cursor {
+				run from;
+				uint64_t pos = 0;
+				pair_cc_t block;
+				size_t next = 0;
+				uint64_t key = 0;
+			};
+
+			const mpi_controller &mpi;
+			collection<cursor> cursors;
+			bool compress;
+
+			struct later {
+				const collection<cursor> *cs;
+				bool operator()(size_t a, size_t b) const {
+					return (*cs)[a].key > (*cs)[b].key;
+				}
+			};
+
+		public:
+			merger(const mpi_controller &mpi, const collection<run> &runs, bool compress):
+					mpi(mpi), compress(compress) {
+				cursors.resize(runs.size());
+				for (size_t i = 0; i < runs.size(); ++i) {
+					cursors[i].from = runs[i];
+				}
+			}
+
+			// calls f(key, values) once per distinct key
+			template <typename F> void each(F &&f) {
+				std::priority_queue<size_t, collection<size_t>, later> heap(later{ &cursors });
+				for (size_t i = 0; i < cursors.size(); ++i) {
+					if ( load(cursors[i]) ) {
+						heap.push(i);
+					}
+				}
+
+				// pairs of one sort key, normally a single key
+				pair_cc_t same;
+				while ( !heap.empty() ) {
+					uint64_t key = cursors[heap.top()].key;
+					while ( !heap.empty() && cursors[heap.top()].key == key ) {
+						size_t i = heap.top();
+						heap.pop();
+						cursor &c = cursors[i];
+						bool more;
+						do {
+							same.push_back(std::move(c.block[c.next++]));
+						} while ( (more = load(c)) && c.key == key );
+						if ( more ) {
+							heap.push(i);
+						}
+					}
+					group::sort_group(same, f);
+					same.clear();
+				}
+			}
+
+		private:
+			// moves c to its next pair, reading a block if needed
+			bool load(cursor &c) {
+				while ( c.next >= c.block.size() ) {
+					c.block.clear();
+					c.next = 0;
+					if ( c.pos >= c.from.bytes ) {
+						return false;
+					}
+					byte_array head, data;
+					c.from.in->read(c.from.offset + c.pos, sizeof(uint64_t), head);
+					uint64_t len = head.read<uint64_t>();
+					c.from.in->read(c.from.offset + c.pos + sizeof(uint64_t), len, data);
+					c.pos += sizeof(uint64_t) + len;
+					if ( compress ) {
+						byte_array plain;
+						if ( !lz::decode(data, plain) ) {
+							mpi.abort("cannot unpack a spilled run");
+						}
+						data = std::move(plain);
+					}
+					c.block = data.read<pair_cc_t>();
+				}
+				int bytes;
+				c.key = group::sort_key(c.block[c.next].first, bytes);
+				return true;
+			}
+		};
+	}
+}
+
+#endif // _ARES_SPILL_HPP_
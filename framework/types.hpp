@@ -2,6 +2,8 @@
 #ifndef _ARES_TYPES_HPP_
 #define _ARES_TYPES_HPP_
 
+#include "view.hpp"
+
 #include "cstddef"
 #include "tuple"
 #include "type_traits"
@@ -18,6 +20,8 @@ namespace ares_impl {
 		typedef error arg_t;
 		typedef error key_t;
 		typedef error val_t;
+		typedef error param_key_t;
+		typedef error param_val_t;
 		typedef error ret_t;
 		typedef error pair_t;
 		typedef error setup_t;
@@ -61,6 +65,7 @@ decltype(has_##elem##_helper<T>(nullptr))
 	def_has(reduce);
 	def_has(combine);
 	def_has(setup);
+	def_has(partition);
 
 #undef def_has
 
@@ -102,8 +107,13 @@ decltype(has_##elem##_helper<T>(nullptr))
 		static_assert(func_t::n_args == 2, "reduce should have 2 parameters");
 
 		typedef typename ftncr_t::ret_t ret_t;
-		typedef typename ftncr_t::template arg_t<0> key_t;
-		typedef typename ftncr_t::template arg_t<1>::value_type val_t;
+
+		// what reduce is passed, and the owned types the map emits (the
+		// same unless reduce takes views)
+		typedef typename ftncr_t::template arg_t<0> param_key_t;
+		typedef typename ftncr_t::template arg_t<1>::value_type param_val_t;
+		typedef owned_t<param_key_t> key_t;
+		typedef owned_t<param_val_t> val_t;
 
 		typedef typename setup_func_type<reduce_t>::type setup_t;
 	};
@@ -112,14 +122,16 @@ decltype(has_##elem##_helper<T>(nullptr))
 
 	template <typename C> struct combine_func_type_impl {
 		typedef C combine_t;
-		typedef function_type<decltype(&combine_t::reduce)> func_t;
+		typedef function_type<decltype(&combine_t::combine)> func_t;
 		typedef function_type_without_cref<func_t> ftncr_t;
 
 		static_assert(func_t::n_args == 2, "combine should have 2 parameters");
 
 		typedef typename ftncr_t::ret_t pair_t;
-		typedef typename ftncr_t::template arg_t<0> key_t;
-		typedef typename ftncr_t::template arg_t<1>::value_type val_t;
+		typedef typename ftncr_t::template arg_t<0> param_key_t;
+		typedef typename ftncr_t::template arg_t<1>::value_type param_val_t;
+		typedef owned_t<param_key_t> key_t;
+		typedef owned_t<param_val_t> val_t;
 
 		typedef typename setup_func_type<combine_t>::type setup_t;
 	};
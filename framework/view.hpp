@@ -0,0 +1,145 @@
+
+#ifndef _ARES_VIEW_HPP_
+#define _ARES_VIEW_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace ares_impl {
+
+	/* read-only views of data owned elsewhere, which reduce and combine
+	 * may take in place of the string and collection the map emits. read
+	 * off the shuffled data they point into the receive buffers, so keys
+	 * and values are grouped and reduced without being copied out; they
+	 * are only valid during the call they are passed to.
+	 */
+	class string_view {
+		const char *_data = nullptr;
+		size_t _size = 0;
+
+	public:
+		string_view() = default;
+		string_view(const char *s, size_t n): _data(s), _size(n) {}
+		string_view(const char *s): _data(s), _size(strlen(s)) {}
+		string_view(const std::string &s): _data(s.data()), _size(s.size()) {}
+
+		const char *data() const { return _data; }
+		size_t size() const { return _size; }
+		size_t length() const { return _size; }
+		bool empty() const { return _size == 0; }
+
+		const char *begin() const { return _data; }
+		const char *end() const { return _data + _size; }
+		char operator[](size_t i) const { return _data[i]; }
+
+		std::string str() const { return std::string(_data, _size); }
+		explicit operator std::string() const { return str(); }
+
+		int compare(const string_view &o) const {
+			int c = memcmp(_data, o._data, _size < o._size ? _size : o._size);
+			return c != 0 ? c : _size < o._size ? -1 : _size > o._size;
+		}
+
+		bool operator==(const string_view &o) const {
+			return _size == o._size && memcmp(_data, o._data, _size) == 0;
+		}
+		bool operator!=(const string_view &o) const { return !(*this == o); }
+		bool operator<(const string_view &o) const { return compare(o) < 0; }
+	};
+
+	/* a view of n values of a trivial type T; the bytes need not be
+	 * aligned for T, so values are read by copy
+	 */
+	template <typename T> class span {
+		static_assert(std::is_trivial<T>::value, "span holds trivial values only");
+
+		const unsigned char *_data = nullptr;
+		size_t _size = 0;
+
+	public:
+		class iterator {
+			const unsigned char *p;
+		public:
+			explicit iterator(const unsigned char *p): p(p) {}
+			T operator*() const {
+				T v;
+				memcpy((void *)&v, p, sizeof(T));
+				return v;
+			}
+			iterator &operator++() { p += sizeof(T); return *this; }
+			bool operator==(const iterator &o) const { return p == o.p; }
+			bool operator!=(const iterator &o) const { return p != o.p; }
+		};
+
+		span() = default;
+		span(const void *data, size_t n): _data((const unsigned char *)data), _size(n) {}
+		span(const std::vector<T> &v): _data((const unsigned char *)v.data()), _size(v.size()) {}
+
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+
+		T operator[](size_t i) const { return *iterator(_data + i * sizeof(T)); }
+
+		iterator begin() const { return iterator(_data); }
+		iterator end() const { return iterator(_data + _size * sizeof(T)); }
+
+		std::vector<T> vec() const {
+			std::vector<T> v(_size);
+			memcpy((void *)v.data(), _data, _size * sizeof(T));
+			return v;
+		}
+	};
+
+	// the type a view is of, which is what map emits and the wire carries
+	template <typename T> struct owned_of { typedef T type; };
+	template <> struct owned_of<string_view> { typedef std::string type; };
+	template <typename T> struct owned_of<span<T>> { typedef std::vector<T> type; };
+
+	template <typename T> using owned_t = typename owned_of<T>::type;
+
+	// a copy of what a view shows, anything else passed through
+	inline std::string owned(const string_view &s) { return s.str(); }
+	template <typename T> std::vector<T> owned(const span<T> &s) { return s.vec(); }
+
+	template <typename T> using is_owned = std::is_same<
+			owned_t<typename std::decay<T>::type>, typename std::decay<T>::type>;
+
+	template <typename T>
+	typename std::enable_if<is_owned<T>::value, T &&>::type owned(T &&v) {
+		return std::forward<T>(v);
+	}
+
+	/* values as the collection a reduce or combine takes, viewed into tmp
+	 * when it takes views of them
+	 */
+	template <typename P, typename V>
+	const std::vector<P> &as_params(const std::vector<V> &values, std::vector<P> &tmp) {
+		tmp.assign(values.begin(), values.end());
+		return tmp;
+	}
+
+	template <typename V>
+	const std::vector<V> &as_params(const std::vector<V> &values, std::vector<V> &) {
+		return values;
+	}
+
+}
+
+namespace std {
+	template <> struct hash<ares_impl::string_view> {
+		// fnv-1a, one byte at a time
+		size_t operator()(const ares_impl::string_view &s) const {
+			uint64_t h = 14695981039346656037ULL;
+			for (char c : s) {
+				h = (h ^ (unsigned char)c) * 1099511628211ULL;
+			}
+			return (size_t)h;
+		}
+	};
+}
+
+#endif // _ARES_VIEW_HPP_
@@ -2,8 +2,31 @@
 #ifndef _ARES_WORKFLOW_HPP_
 #define _ARES_WORKFLOW_HPP_
 
+#include "arena.hpp"
+#include "chunks.hpp"
+#include "combine.hpp"
+#include "compress.hpp"
+#include "executor.hpp"
+#include "group.hpp"
+#include "helper.hpp"
 #include "mpi.hpp"
-
+#include "profile.hpp"
+#include "results.hpp"
+#include "side.hpp"
+#include "shuffle.hpp"
+#include "skew.hpp"
+#include "spill.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <typeindex>
 #include <unordered_map>
 
@@ -11,21 +34,96 @@ namespace ares_impl {
 
 	class work_flow {
 	public:
+		// records a map thread takes from mapped_data at a time
+		static constexpr size_t MAP_BATCH = 256;
+
+		static constexpr int SCATTER_TAG = 0x5c00;
+		static constexpr int STREAM_TAG = 0x5c01;
+
 		mpi_controller mpi;
+		config conf;
+
+		// state of the running job
+		size_t job_seq = 0;
+		shuffle *pipe = nullptr;
+		spill::store *spills = nullptr;
 
 		byte_array mapped_data;
-		byte_array m_side_data;
-		byte_array r_side_data;
-		byte_array c_side_data;
+
+		// with config::map_chunk the map input is handed out in chunks: the
+		// master holds the chunks of scattered data, or every rank knows
+		// the file they are read from
+		bool chunked = false;
+		collection<byte_array> input_chunks;
+		std::string input_file;
+		size_t input_total = 0;
+
+		// named datasets: results of jobs left on the ranks that reduced
+		// them, each part laid out as map input ([count][elements]), so a
+		// later job maps them in place; input_dataset is the one
+		// mapped_data views, if any
+		std::unordered_map<std::string, byte_array> datasets;
+		std::string input_dataset;
+
+		// each rank's results of run_to_stream jobs, by stream, until the
+		// master fetches them
+		std::unordered_map<uint64_t, byte_array> streams;
+		uint64_t stream_seq = 0;
+
+		side_data m_side_data;
+		side_data r_side_data;
+		side_data c_side_data;
+
+		// the tables of the running job's reduce, with config::arena
+		arena pool;
+
+		// this rank's timings since the last job, and where the master
+		// appends the reports (stderr when empty)
+		profiler prof;
+		std::string profile_path;
+
+		// the master's submitted jobs, run on a thread of their own when
+		// MPI lets threads call it in turn, else right away
+		executor jobs;
+		bool serialized = false;
+
+		work_flow(): prof(mpi.size()) {}
 
 		static work_flow *&instance() {
 			static work_flow *impl;
 			return impl;
 		}
 
+		// the instance, once the jobs submitted before have run
+		static work_flow *ready() {
+			work_flow *wf = instance();
+			wf->jobs.drain();
+			return wf;
+		}
+
+		template <typename T> std::future<T> submit(std::function<T()> task) {
+			auto promise = std::make_shared<std::promise<T>>();
+			std::future<T> future = promise->get_future();
+			std::function<void()> run = [promise, task] {
+				promise->set_value(task());
+			};
+			if ( serialized ) {
+				jobs.post(std::move(run));
+			} else {
+				run();
+			}
+			return future;
+		}
+
 		typedef void *(work_flow::*handler_t)(void *);
 		std::unordered_map<std::type_index, size_t> index;
 		std::vector<handler_t> hlist;
+		handler_t combiner = nullptr;
+		handler_t combiner_factory = nullptr;
+
+		// std::function<size_t(const key_t &)> giving the home rank of a key,
+		// left by do_map for the reduce stage
+		std::shared_ptr<void> partitioner;
 
 		template <typename M> void m_register(std::true_type) {
 			index[typeid(map_func_type<M>)] = hlist.size();
@@ -33,15 +131,19 @@ namespace ares_impl {
 		}
 		template <typename> void m_register(std::false_type) {}
 
+		// the result writer always follows do_reduce in hlist
 		template <typename R> void r_register(std::true_type) {
 			index[typeid(reduce_func_type<R>)] = hlist.size();
 			hlist.push_back(&work_flow::do_reduce<R>);
+			hlist.push_back(&work_flow::write_results<R>);
 		}
 		template <typename> void r_register(std::false_type) {}
 
+		// the combiner factory always follows do_combine in hlist
 		template <typename C> void c_register(std::true_type) {
 			index[typeid(combine_func_type<C>)] = hlist.size();
 			hlist.push_back(&work_flow::do_combine<C>);
+			hlist.push_back(&work_flow::make_combiner<C>);
 		}
 		template <typename> void c_register(std::false_type) {}
 
@@ -53,70 +155,507 @@ namespace ares_impl {
 		}
 		void register_type() {}
 
+		/* the master cuts arg_cc into one run of elements per rank, of about
+		 * the same serialized size, writes the runs on map_threads threads
+		 * and sends each one as soon as it is written
+		 */
 		template <typename T>
 		void scatter(const collection<T> &arg_cc) {
-			typedef T arg_t;
-			typedef collection<arg_t> arg_cc_t;
+			profiler::scope timing(prof, phase::scatter);
 
 			command head;
 			head.code = opt_code::map_data;
 			mpi.bcast(head);
 
+			input_chunks.clear();
+			input_file.clear();
+			input_dataset.clear();
+			chunked = conf.map_chunk > 0;
+			if ( chunked ) {
+				make_chunks(arg_cc);
+				return;
+			}
+
 			size_t size = mpi.size();
-			byte_array datas[size];
+			collection<size_t> bounds = balance(arg_cc, size);
+			collection<byte_array> parts(size);
+			collection<uint64_t> lens(size);
+
+			// the runs of other ranks go first, this rank's own last
+			std::mutex lock;
+			std::atomic<size_t> next(0);
+			collection<size_t> written;
+			auto write = [&](size_t i) {
+				size_t k = (mpi.id() + 1 + i) % size;
+				byte_array plain;
+				byte_array &out = conf.compress ? plain : parts[k];
+				out.write(bounds[k + 1] - bounds[k]);
+				for (size_t e = bounds[k]; e < bounds[k + 1]; ++e) {
+					out.write(arg_cc[e]);
+				}
+				if ( conf.compress ) {
+					lz::encode(plain.data(), plain.size(), parts[k], k == (size_t)mpi.id());
+				}
+				std::lock_guard<std::mutex> guard(lock);
+				written.push_back(k);
+			};
+
+			collection<std::thread> threads;
+			size_t n = std::max<size_t>(1, std::min(conf.map_threads, size));
+			for (size_t t = 1; t < n; ++t) {
+				threads.emplace_back([&] {
+					for (size_t i; (i = next++) < size; ) {
+						write(i);
+					}
+				});
+			}
 
-			size_t curr = 0;
+			collection<MPI_Request> reqs;
+			size_t sent = 0;
+			auto send_written = [&] {
+				collection<size_t> ready;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					ready.swap(written);
+				}
+				for (size_t k : ready) {
+					if ( k == (size_t)mpi.id() ) {
+						mapped_data = std::move(parts[k]);
+					} else {
+						lens[k] = parts[k].size();
+						mpi.isend_sized(parts[k], lens[k], (int)k, SCATTER_TAG, reqs);
+					}
+					++sent;
+				}
+			};
+			for (size_t i; (i = next++) < size; ) {
+				write(i);
+				send_written();
+			}
+			while ( sent < size ) {
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				send_written();
+			}
+			for (std::thread &thread : threads) {
+				thread.join();
+			}
+			mpi.wait(reqs);
+			unpack(mapped_data);
+		}
 
-			for (size_t k = 0; k < size; ++k) {
-				size_t one = (arg_cc.size() + size - 1) / size;
-				one = std::min(one, arg_cc.size() - curr);
-				datas[k].write(one);
-				for (size_t i = curr; i < curr + one; ++i) {
-					datas[k].write(arg_cc[i]);
+		// the master keeps arg_cc as chunks of about map_chunk bytes
+		template <typename T> void make_chunks(const collection<T> &arg_cc) {
+			collection<size_t> bounds = balance(arg_cc, 0, conf.map_chunk);
+			input_total = bounds.size() - 1;
+			input_chunks.resize(input_total);
+			for (size_t c = 0; c < input_total; ++c) {
+				byte_array &chunk = input_chunks[c];
+				chunk.write(bounds[c + 1] - bounds[c]);
+				for (size_t e = bounds[c]; e < bounds[c + 1]; ++e) {
+					chunk.write(arg_cc[e]);
 				}
-				curr += one;
+				pack(chunk, false);
 			}
+		}
 
-			mpi.scatter(datas, mapped_data);
+		/* bounds[k] is the first element of the k-th of size runs, bounds[size]
+		 * the end; with chunk, size is chosen to give runs of about chunk bytes
+		 */
+		template <typename T>
+		static collection<size_t> balance(const collection<T> &arg_cc, size_t size, size_t chunk = 0) {
+			collection<size_t> ends(arg_cc.size());
+			size_t total = 0;
+			for (size_t i = 0; i < arg_cc.size(); ++i) {
+				total += wire_size(arg_cc[i]);
+				ends[i] = total;
+			}
+			if ( chunk > 0 ) {
+				size = std::max<size_t>(1, (total + chunk - 1) / chunk);
+			}
+			collection<size_t> bounds(size + 1, arg_cc.size());
+			bounds[0] = 0;
+			for (size_t k = 1; k < size; ++k) {
+				size_t target = total / size * k + total % size * k / size;
+				bounds[k] = std::upper_bound(ends.begin(), ends.end(), target) - ends.begin();
+			}
+			return bounds;
 		}
 
-		template <typename T> void set_side_data(const T &data, byte_array &bytes, opt_code opt) {
-			bytes.clear();
-			bytes.write(data);
+		// every rank reads its own byte range of the file, a line per record
+		void scatter_file(const std::string &name) {
+			profiler::scope timing(prof, phase::scatter);
+			byte_array bytes;
+			bytes.write(name);
 
 			command head;
-			head.code = opt;
+			head.code = opt_code::map_file;
 			head.value = bytes.size();
 			mpi.bcast(head);
 
 			mpi.bcast(bytes, bytes.size());
+			load_file(bytes.read<std::string>());
+		}
+
+		void load_file(const std::string &name) {
+			mapped_data.clear();
+			input_chunks.clear();
+			input_file.clear();
+			input_dataset.clear();
+			chunked = conf.map_chunk > 0;
+			if ( chunked ) {
+				input_file = name;
+				size_t bytes = mpi.is_m() ? helper::filesize(name) : 0;
+				input_total = std::max<size_t>(1, (bytes + conf.map_chunk - 1) / conf.map_chunk);
+				return;
+			}
+			collection<std::string> lines = helper::readfile(name, mpi.id(), mpi.size());
+			mapped_data.write(lines);
+		}
+
+		/* the ranks keep the side data they were last sent, so nothing is
+		 * sent when data is the same, and only the changed blocks when
+		 * few of them are; see side_data
+		 */
+		template <typename T> void set_side_data(const T &data, side_data &side, opt_code opt) {
+			byte_array bytes;
+			bytes.write(data);
+			if ( side.same(bytes) ) {
+				return;
+			}
+
+			collection<uint64_t> blocks = side.changed_blocks(bytes);
+			bool delta = blocks.size() * side_data::BLOCK * 2 < bytes.size();
+			byte_array args, picked;
+			args.write(delta);
+			args.write(bytes.size());
+			if ( delta ) {
+				args.write(blocks);
+				picked = side_data::pick(bytes, blocks);
+			} else {
+				picked = bytes.view();
+			}
+			args.write(picked.size());
+
+			command head;
+			head.code = opt;
+			head.value = args.size();
+			mpi.bcast(head);
+
+			mpi.bcast(args, args.size());
+			mpi.bcast_pipelined(picked, picked.size());
+			side.replace(std::move(bytes));
+		}
+
+		// the receiving side of set_side_data, len bytes of args
+		void recv_side_data(side_data &side, size_t len) {
+			byte_array args, picked;
+			mpi.bcast(args, len);
+			bool delta = args.read<bool>();
+			size_t size = args.read<size_t>();
+			collection<uint64_t> blocks;
+			if ( delta ) {
+				blocks = args.read<collection<uint64_t>>();
+			}
+			mpi.bcast_pipelined(picked, args.read<size_t>());
+			if ( delta ) {
+				side.patch(size, blocks, picked);
+			} else {
+				side.replace(std::move(picked));
+			}
+		}
+
+		void set_config(const config &c) {
+			conf = c;
+
+			command head;
+			head.code = opt_code::config;
+			mpi.bcast(head);
+
+			mpi.bcast(conf);
+		}
+
+		/* with config::compress, what goes on the wire is lz blocks: pack
+		 * encodes bytes in place (only storing them when they stay on this
+		 * rank), unpack turns received blocks back into an owned array
+		 */
+		void pack(byte_array &bytes, bool local) const {
+			if ( conf.compress && bytes.size() > 0 ) {
+				byte_array blocks;
+				lz::encode(bytes.data(), bytes.size(), blocks, local);
+				bytes = std::move(blocks);
+			}
+		}
+
+		void unpack(byte_array &bytes) const {
+			if ( conf.compress && bytes.size() > 0 ) {
+				byte_array plain;
+				if ( !lz::decode(bytes, plain) ) {
+					mpi.abort("cannot unpack received data");
+				}
+				bytes = std::move(plain);
+			}
 		}
 
 		handler_t get_handler(size_t idx, int shift) {
 			return hlist[(idx >> shift) & 0xffffUL];
 		}
 
-		void do_job(size_t idx, byte_array final[]) {
+		// runs map, combine and reduce, returns this rank's serialized results
+		byte_array *do_stages(size_t idx) {
 			void *p = nullptr;
 			handler_t m = get_handler(idx, 32);
 			handler_t r = get_handler(idx, 16);
 			handler_t c = get_handler(idx, 00);
 
-			p = (this->*m)(p);
+			combiner = c;
+			combiner_factory = c ? hlist[(idx & 0xffffUL) + 1] : nullptr;
+			if ( conf.spill_budget > 0 ) {
+				spills = new spill::store();
+			} else if ( conf.shuffle_budget > 0 ) {
+				pipe = new shuffle(mpi, job_seq, conf.map_threads);
+			}
+
+			{
+				profiler::scope timing(prof, phase::map);
+				p = (this->*m)(p);
+			}
 			if ( c != nullptr ) {
+				profiler::scope timing(prof, phase::combine);
 				p = (this->*c)(p);
 			}
 			p = (this->*r)(p);
 
-			byte_array * result= (byte_array *)p;
-			mpi.gather(*result, final);
+			delete pipe;
+			pipe = nullptr;
+			delete spills;
+			spills = nullptr;
+			pool.release();
+			++job_seq;
+
+			return (byte_array *)p;
+		}
+
+		void do_job(size_t idx, byte_array &gathered, byte_array final[]) {
+			byte_array * result= do_stages(idx);
+			{
+				profiler::scope timing(prof, phase::gather);
+				pack(*result, mpi.is_m());
+				mpi.gather(*result, gathered, final);
+				for (size_t k = 0; k < mpi.size() && final != nullptr; ++k) {
+					unpack(final[k]);
+				}
+			}
 			delete result;
+			report_profile();
 		}
 
-		template <typename M, typename R, typename C>
-		typename job<M, R, C>::ret_cc_t do_run() {
+		/* one round of an iterative job: the results of all ranks are
+		 * allgathered straight into every rank's m_side_data, as one
+		 * collection, ready for the next round's setup
+		 */
+		void do_iteration(size_t idx) {
+			byte_array *result = do_stages(idx);
+			{
+				profiler::scope timing(prof, phase::gather);
+				size_t total = mpi.sum(result->read<size_t>());
+
+				byte_array all;
+				all.write(total);
+				byte_array elems = result->view(sizeof(size_t), result->remain());
+				mpi.allgather(elems, all);
+				m_side_data.replace(std::move(all));
+			}
+			delete result;
+			report_profile();
+		}
+
+		/* runs the job and writes this rank's results to a file of its own
+		 * next to prefix; the master gets what every rank wrote.
+		 * args holds the job index, the format and the prefix
+		 */
+		void write_op(byte_array &args, byte_array &gathered, byte_array final[]) {
+			size_t idx = args.read<size_t>();
+			part_output out;
+			out.format = (result_format)args.read<uint64_t>();
+			std::string prefix = args.read<std::string>();
+			out.results = do_stages(idx);
+			{
+				profiler::scope timing(prof, phase::gather);
+				char suffix[32];
+				snprintf(suffix, sizeof(suffix), ".part-%05d", mpi.id());
+				out.part.path = prefix + suffix;
+				(this->*hlist[((idx >> 16) & 0xffffUL) + 1])(&out);
+
+				byte_array mine;
+				mine.write(out.part.path);
+				mine.write(out.part.count);
+				mine.write(out.part.bytes);
+				mine.write((uint64_t)out.part.format);
+				mine.write(out.ok);
+				mpi.gather(mine, gathered, final);
+			}
+			delete out.results;
+			report_profile();
+		}
+
+		// runs the job and keeps this rank's results for the master to fetch
+		void keep_stream(size_t idx) {
+			byte_array *result = do_stages(idx);
+			streams[stream_seq++] = std::move(*result);
+			delete result;
+			report_profile();
+		}
+
+		/* args holds a stream and a rank, which sends its part of the
+		 * stream to the master, into out, and drops it; past the last rank
+		 * every rank drops what is left of the stream
+		 */
+		void stream_op(byte_array &args, byte_array *out) {
+			uint64_t id = args.read<uint64_t>();
+			size_t k = args.read<uint64_t>();
+			auto it = streams.find(id);
+			byte_array part;
+			if ( it != streams.end() ) {
+				if ( k == (size_t)mpi.id() ) {
+					part = std::move(it->second);
+				}
+				if ( k == (size_t)mpi.id() || k >= mpi.size() ) {
+					streams.erase(it);
+				}
+			}
+			if ( k >= mpi.size() ) {
+				return;
+			}
+
+			if ( mpi.is_m() && k == (size_t)mpi.id() ) {
+				*out = std::move(part);
+			} else if ( mpi.is_m() ) {
+				mpi.recv_sized(*out, (int)k, STREAM_TAG);
+				unpack(*out);
+			} else if ( k == (size_t)mpi.id() ) {
+				pack(part, false);
+				uint64_t len = part.size();
+				collection<MPI_Request> reqs;
+				mpi.isend_sized(part, len, mpi.master(), STREAM_TAG, reqs);
+				mpi.wait(reqs);
+			}
+		}
+
+		// the master's side of result_stream::fetch_t
+		void fetch_stream(uint64_t id, size_t k, byte_array &out) {
+			byte_array args;
+			args.write(id);
+			args.write((uint64_t)k);
+			if ( k != (size_t)mpi.id() ) {
+				command head;
+				head.code = opt_code::stream_part;
+				head.value = args.size();
+				mpi.bcast(head);
+				mpi.bcast(args, args.size());
+			}
+			stream_op(args, &out);
+		}
+
+		// the master checks name exists and has every rank run op on it
+		bool bcast_dataset_op(opt_code code, const std::string &name, byte_array &args) {
+			if ( code != opt_code::keep_dataset && datasets.count(name) == 0 ) {
+				fprintf(stderr, "no dataset %s\n", name.c_str());
+				return false;
+			}
+			args.write(name);
+
+			command head;
+			head.code = code;
+			head.value = args.size();
+			mpi.bcast(head);
+			mpi.bcast(args, args.size());
+			return true;
+		}
+
+		// args holds the job index for keep_dataset, then the name
+		size_t dataset_op(opt_code code, byte_array &args, byte_array &gathered, byte_array final[]) {
+			size_t idx = code == opt_code::keep_dataset ? args.read<size_t>() : 0;
+			std::string name = args.read<std::string>();
+			auto release = [&] {
+				if ( name == input_dataset ) {
+					mapped_data.clear();
+					input_dataset.clear();
+				}
+			};
+
+			switch (code) {
+			case opt_code::keep_dataset: {
+				byte_array *result = do_stages(idx);
+				release();
+				size_t total = mpi.sum(result->read<size_t>());
+				result->reset();
+				datasets[name] = std::move(*result);
+				delete result;
+				report_profile();
+				return total;
+			}
+			case opt_code::map_dataset: {
+				profiler::scope timing(prof, phase::scatter);
+				input_chunks.clear();
+				input_file.clear();
+				chunked = false;
+				mapped_data = datasets[name].view();
+				input_dataset = name;
+				break;
+			}
+			case opt_code::gather_dataset: {
+				profiler::scope timing(prof, phase::gather);
+				byte_array part = datasets[name].view();
+				pack(part, mpi.is_m());
+				mpi.gather(part, gathered, final);
+				for (size_t k = 0; k < mpi.size() && final != nullptr; ++k) {
+					unpack(final[k]);
+				}
+				break;
+			}
+			default:
+				release();
+				datasets.erase(name);
+				break;
+			}
+			return 0;
+		}
+
+		/* when profiling, gathers every rank's timings to the master, which
+		 * appends one json line for the job; then starts the next profile
+		 */
+		void report_profile() {
+			size_t size = mpi.size();
+			if ( conf.profile ) {
+				byte_array mine, gathered, datas[size];
+				prof.write_to(mine);
+				mpi.gather(mine, gathered, mpi.is_m() ? datas : nullptr);
+
+				if ( mpi.is_m() ) {
+					collection<profiler> ranks;
+					for (size_t k = 0; k < size; ++k) {
+						ranks.emplace_back(datas[k]);
+					}
+					std::string line = profile_json(job_seq - 1, ranks.data(), size);
+					FILE *out = stderr;
+					if ( !profile_path.empty() ) {
+						out = fopen(profile_path.c_str(), "a");
+					}
+					if ( out == nullptr ) {
+						fprintf(stderr, "cannot open profile output %s\n", profile_path.c_str());
+					} else {
+						fprintf(out, "%s\n", line.c_str());
+						if ( out != stderr ) {
+							fclose(out);
+						}
+					}
+				}
+			}
+			prof.clear(size);
+		}
+
+		template <typename M, typename R, typename C> size_t job_index() {
 			typedef job<M, R, C> job;
-			typedef typename job::ret_cc_t ret_cc_t;
 
 			size_t m_idx, r_idx, c_idx;
 			m_idx = index[typeid(typename job::map_func)];
@@ -125,17 +664,27 @@ namespace ares_impl {
 
 			if ( m_idx == 0 || r_idx == 0 ) {
 				fprintf(stderr, "unregistered map or reduce type\n");
-				return ret_cc_t();
+				return 0;
 			}
+			return (m_idx << 32) | (r_idx << 16) | c_idx;
+		}
+
+		template <typename M, typename R, typename C>
+		typename job<M, R, C>::ret_cc_t do_run() {
+			typedef job<M, R, C> job;
+			typedef typename job::ret_cc_t ret_cc_t;
 
 			command head;
 			head.code = opt_code::start;
-			head.value = (m_idx << 32) | (r_idx << 16) | c_idx;
+			head.value = job_index<M, R, C>();
+			if ( head.value == 0 ) {
+				return ret_cc_t();
+			}
 			mpi.bcast(head);
 
 			size_t size = mpi.size();
-			byte_array datas[size];
-			do_job(head.value, datas);
+			byte_array gathered, datas[size];
+			do_job(head.value, gathered, datas);
 
 			ret_cc_t ret_cc;
 			for (size_t k = 0; k < size; ++k) {
@@ -146,6 +695,140 @@ namespace ares_impl {
 			return std::move(ret_cc);
 		}
 
+		template <typename M, typename R, typename C, typename F>
+		typename job<M, R, C>::ret_cc_t do_iterate(size_t n, F &&converged) {
+			typedef job<M, R, C> job;
+			typedef typename job::ret_cc_t ret_cc_t;
+
+			static_assert(std::is_same<typename job::m_setup_t, ret_cc_t>::value,
+					"map setup should take the collection of reduce results");
+
+			command head;
+			head.code = opt_code::iterate;
+			head.value = job_index<M, R, C>();
+			if ( head.value == 0 ) {
+				return ret_cc_t();
+			}
+
+			ret_cc_t prev, curr;
+			if ( m_side_data.bytes.size() > 0 ) {
+				prev = m_side_data.bytes.read<ret_cc_t>();
+				m_side_data.bytes.reset();
+			}
+			for (size_t i = 0; i < n; ++i) {
+				mpi.bcast(head);
+				do_iteration(head.value);
+
+				curr = m_side_data.bytes.read<ret_cc_t>();
+				m_side_data.bytes.reset();
+				bool done = converged(prev, curr);
+				prev.swap(curr);
+				if ( done ) {
+					break;
+				}
+			}
+			return prev;
+		}
+
+		template <typename M, typename R, typename C>
+		result_stream<typename job<M, R, C>::ret_t> do_stream() {
+			typedef result_stream<typename job<M, R, C>::ret_t> stream_t;
+
+			command head;
+			head.code = opt_code::keep_stream;
+			head.value = job_index<M, R, C>();
+			if ( head.value == 0 ) {
+				return stream_t();
+			}
+			mpi.bcast(head);
+			uint64_t id = stream_seq;
+			keep_stream(head.value);
+			return stream_t(mpi.size(), [id](size_t k, byte_array &out) {
+				work_flow::ready()->fetch_stream(id, k, out);
+			});
+		}
+
+		template <typename M, typename R, typename C>
+		result_manifest do_write(const std::string &prefix, result_format format) {
+			result_manifest manifest;
+			byte_array args;
+			size_t idx = job_index<M, R, C>();
+			if ( idx == 0 ) {
+				manifest.complete = false;
+				return manifest;
+			}
+			args.write(idx);
+			args.write((uint64_t)format);
+			args.write(prefix);
+
+			command head;
+			head.code = opt_code::write_results;
+			head.value = args.size();
+			mpi.bcast(head);
+			mpi.bcast(args, args.size());
+
+			size_t size = mpi.size();
+			byte_array gathered, datas[size];
+			write_op(args, gathered, datas);
+
+			std::string path = prefix + ".manifest";
+			FILE *out = fopen(path.c_str(), "w");
+			if ( out == nullptr ) {
+				fprintf(stderr, "cannot open manifest %s\n", path.c_str());
+			}
+			for (size_t k = 0; k < size; ++k) {
+				result_part part;
+				part.path = datas[k].template read<std::string>();
+				part.count = datas[k].template read<size_t>();
+				part.bytes = datas[k].template read<uint64_t>();
+				part.format = (result_format)datas[k].template read<uint64_t>();
+				manifest.complete = datas[k].template read<bool>() && manifest.complete;
+				manifest.total += part.count;
+				if ( out != nullptr ) {
+					fprintf(out, "%s\t%zu\t%llu\t%s\n", part.path.c_str(), part.count,
+							(unsigned long long)part.bytes,
+							part.format == result_format::text ? "text" : "binary");
+				}
+				manifest.parts.push_back(std::move(part));
+			}
+			if ( out != nullptr ) {
+				fclose(out);
+			}
+			return manifest;
+		}
+
+		template <typename M, typename R, typename C> size_t do_keep(const std::string &name) {
+			byte_array args, gathered;
+			size_t idx = job_index<M, R, C>();
+			args.write(idx);
+			if ( idx == 0 || !bcast_dataset_op(opt_code::keep_dataset, name, args) ) {
+				return 0;
+			}
+			return dataset_op(opt_code::keep_dataset, args, gathered, nullptr);
+		}
+
+		template <typename T> collection<T> do_gather(const std::string &name) {
+			size_t size = mpi.size();
+			byte_array args, gathered, datas[size];
+			collection<T> all;
+			if ( !bcast_dataset_op(opt_code::gather_dataset, name, args) ) {
+				return all;
+			}
+			dataset_op(opt_code::gather_dataset, args, gathered, datas);
+			for (size_t k = 0; k < size; ++k) {
+				collection<T> cc = datas[k].template read<collection<T>>();
+				std::move(cc.begin(), cc.end(), std::back_inserter(all));
+			}
+			return all;
+		}
+
+		void do_dataset(opt_code code, const std::string &name) {
+			byte_array args, gathered;
+			if ( bcast_dataset_op(code, name, args) ) {
+				dataset_op(code, args, gathered, nullptr);
+			}
+		}
+
 		void exit_all(int code) {
 			command head;
 			head.code = opt_code::exit;
@@ -159,6 +842,7 @@ namespace ares_impl {
 		}
 
 		static void when_exit() {
+			instance()->jobs.stop();
 			instance()->exit_all(0);
 			instance()->finalize();
 		}
@@ -171,35 +855,117 @@ namespace ares_impl {
 			case opt_code::exit:
 				finalize();
 				exit((int)head.value);
-			case opt_code::start:
-				do_job(head.value, nullptr);
+			case opt_code::start: {
+				byte_array gathered;
+				do_job(head.value, gathered, nullptr);
+				break;
+			}
+			case opt_code::iterate:
+				do_iteration(head.value);
+				break;
+			case opt_code::keep_dataset:
+			case opt_code::map_dataset:
+			case opt_code::gather_dataset:
+			case opt_code::drop_dataset: {
+				byte_array args, gathered;
+				mpi.bcast(args, head.value);
+				dataset_op(head.code, args, gathered, nullptr);
+				break;
+			}
+			case opt_code::write_results: {
+				byte_array args, gathered;
+				mpi.bcast(args, head.value);
+				write_op(args, gathered, nullptr);
+				break;
+			}
+			case opt_code::keep_stream:
+				keep_stream(head.value);
 				break;
-			case opt_code::map_data:
+			case opt_code::stream_part: {
+				byte_array args;
+				mpi.bcast(args, head.value);
+				stream_op(args, nullptr);
+				break;
+			}
+			case opt_code::map_data: {
+				profiler::scope timing(prof, phase::scatter);
 				mapped_data.clear();
-				mpi.scatter(nullptr, mapped_data);
+				input_chunks.clear();
+				input_file.clear();
+				input_dataset.clear();
+				chunked = conf.map_chunk > 0;
+				if ( !chunked ) {
+					mpi.recv_sized(mapped_data, mpi.master(), SCATTER_TAG);
+					unpack(mapped_data);
+				}
 				break;
+			}
+			case opt_code::map_file: {
+				profiler::scope timing(prof, phase::scatter);
+				byte_array bytes;
+				mpi.bcast(bytes, head.value);
+				load_file(bytes.read<std::string>());
+				break;
+			}
 			case opt_code::m_side_data:
-				m_side_data.clear();
-				mpi.bcast(m_side_data, head.value);
+				recv_side_data(m_side_data, head.value);
 				break;
 			case opt_code::r_side_data:
-				r_side_data.clear();
-				mpi.bcast(r_side_data, head.value);
+				recv_side_data(r_side_data, head.value);
 				break;
 			case opt_code::c_side_data:
-				c_side_data.clear();
-				mpi.bcast(c_side_data, head.value);
+				recv_side_data(c_side_data, head.value);
+				break;
+			case opt_code::config:
+				mpi.bcast(conf);
 				break;
 			}
 		}
 
-		template <typename V, typename T> static void
-		setup(T &t, byte_array &bs, std::true_type) {
-			t.setup(bs.read<V>());
-			bs.reset();
+		/* a new stage object for the job: a type with setup is set up from
+		 * the side data of its stage, which must have been set. a setup
+		 * taking const V & reads the value kept in side, any other gets a
+		 * copy of it
+		 */
+		template <typename V, typename T> std::shared_ptr<T>
+		set_up(side_data &side, std::true_type) {
+			typedef typename setup_func_type<T>::func_t::template arg_t<0> param_t;
+			if ( side.bytes.size() == 0 ) {
+				mpi.abort("a stage has setup but no side data was set for it");
+			}
+			std::shared_ptr<const V> value = side.get<V>();
+			std::shared_ptr<T> t = std::make_shared<T>();
+			give_setup(*t, *value, std::is_same<param_t, const V &>());
+			return t;
+		}
+		template <typename T, typename V> static void
+		give_setup(T &t, const V &value, std::true_type) {
+			t.setup(value);
+		}
+		template <typename T, typename V> static void
+		give_setup(T &t, const V &value, std::false_type) {
+			t.setup(V(value));
+		}
+		template <typename, typename T> std::shared_ptr<T>
+		set_up(side_data &, std::false_type) {
+			return std::make_shared<T>();
+		}
+
+		// a map type may choose ranks with static size_t partition(const K &, size_t)
+		template <typename M, typename K> static size_t
+		home_of(const K &key, size_t size, std::true_type) {
+			return M::partition(key, size) % size;
+		}
+		template <typename M, typename K> static size_t
+		home_of(const K &key, size_t size, std::false_type) {
+			using std::hash;
+			return hash<K>()(key) % size;
+		}
+
+		// hot keys are only spread when their partial results can be combined
+		bool split_hot_keys() const {
+			return conf.skew_sample > 0 && combiner_factory != nullptr && conf.spill_budget == 0;
 		}
-		template <typename, typename T> static void
-		setup(T &, byte_array &, std::false_type) {}
 
 		template <typename M> void *do_map(void *) {
 			typedef map_func_type<M> map_func;
@@ -211,25 +977,335 @@ namespace ares_impl {
 			typedef collection<arg_t> arg_cc_t;
 			typedef collection<pair_t> pair_cc_t;
 
-			map_t mapper;
-			setup<typename map_func::setup_t>(mapper, m_side_data, has_setup<map_t>());
-
-			using std::hash;
-			hash<key_t> hfunc;
 			size_t size = mpi.size();
-			pair_cc_t mid_cc_part, *pair_cc = new pair_cc_t[size];
+			bool speculate = chunked && conf.speculate;
+			size_t count = chunked ? 0 : mapped_data.read<size_t>();
+			size_t n = std::max<size_t>(1, std::min(conf.map_threads, chunked ? conf.map_threads : count));
+			prof.records += count;
+
+			// one mapper per thread, set up here since setup reads m_side_data
+			collection<std::shared_ptr<map_t>> mappers(n);
+			for (std::shared_ptr<map_t> &mapper : mappers) {
+				mapper = set_up<typename map_func::setup_t, map_t>(m_side_data, has_setup<map_t>());
+			}
+
+			// with a pipelined shuffle each thread flushes its buckets as a
+			// round once they hold its share of the budget in serialized
+			// bytes; spilling, it writes them to its file once they hold
+			// its share of the spill budget
+			size_t share = (spills != nullptr ? conf.spill_budget : conf.shuffle_budget) / n + 1;
+			if ( spills != nullptr ) {
+				spills->runs.assign(size, collection<spill::run>());
+				for (size_t t = 0; t < n; ++t) {
+					spills->files.emplace_back();
+				}
+			}
+
+			// with an in-mapper combining buffer, pairs are folded by key
+			// before they reach the buckets
+			typedef combine_buffer<key_t, val_t> buffer_t;
+			collection<buffer_t *> buffers(n, nullptr);
+			for (size_t t = 0; t < n && combiner_factory && conf.combine_buffer && !speculate; ++t) {
+				auto *comb = (combiner_base<key_t, val_t> *)(this->*combiner_factory)(nullptr);
+				buffers[t] = new buffer_t(comb, conf.combine_buffer, conf.arena);
+			}
+
+			typedef std::function<size_t(const key_t &)> partition_t;
+			partitioner = std::make_shared<partition_t>([size](const key_t &key) {
+				return home_of<map_t>(key, size, has_partition<map_t>());
+			});
+
+			std::mutex lock;
+			std::atomic<size_t> running(n);
+			collection<pair_cc_t *> outs(n);
+
+			// chunked input: the MPI thread keeps at most one chunk fetched
+			// beyond the one being read, the others wait for them
+			std::unique_ptr<chunk_queue> queue;
+			std::atomic<bool> feeding(chunked);
+			if ( chunked ) {
+				mapped_data.clear();
+				queue.reset(new chunk_queue(mpi, input_file.empty() ? &input_chunks : nullptr,
+						input_total, speculate));
+			}
+
+			// speculating, each chunk maps into buckets of its own, one set
+			// per thread, kept until the master names the copy that counts;
+			// batches never span two chunks. a copy another rank finished
+			// first is stopped: its records left unread are skipped, and
+			// the threads mapping it leave their batch
+			struct run_t {
+				size_t index, unread, end;
+				std::atomic<size_t> left;
+				std::atomic<bool> stopped;
+				collection<pair_cc_t *> outs;
+				run_t(size_t index, size_t count, size_t end, size_t n):
+						index(index), unread(count), end(end), left(count),
+						stopped(false), outs(n, nullptr) {}
+			};
+			std::deque<std::unique_ptr<run_t>> runs;
+			size_t reading = 0;
+			collection<size_t> finished, stopped;
+
+			// the records left unread of each chunk fetched, in order
+			std::deque<size_t> unread;
+			auto low = [&] {
+				std::lock_guard<std::mutex> guard(lock);
+				return unread.size() < 2;
+			};
+			auto read_off = [&](size_t left) {
+				while ( left > 0 ) {
+					size_t some = std::min(left, unread.front());
+					left -= some;
+					if ( (unread.front() -= some) == 0 ) {
+						unread.pop_front();
+					}
+				}
+			};
+			auto stop = [&] {
+				for (uint64_t index : queue->stopped()) {
+					std::lock_guard<std::mutex> guard(lock);
+					auto it = std::find_if(runs.begin(), runs.end(),
+							[index](const std::unique_ptr<run_t> &run) { return run->index == index; });
+					if ( it != runs.end() ) {
+						(*it)->stopped = true;
+					} else {
+						stopped.push_back(index);
+					}
+				}
+			};
+			auto report = [&] {
+				collection<size_t> done;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					done.swap(finished);
+				}
+				for (size_t index : done) {
+					queue->done(index);
+				}
+			};
+			auto refill = [&] {
+				size_t index, total;
+				report();
+				stop();
+				while ( feeding && low() ) {
+					byte_array chunk;
+					int got = queue->take(index, total, chunk);
+					if ( got < 0 ) {
+						break;
+					} else if ( got == 0 ) {
+						feeding = false;
+						break;
+					}
+					if ( speculate && std::find(stopped.begin(), stopped.end(), index) != stopped.end() ) {
+						continue;
+					}
+					if ( !input_file.empty() ) {
+						chunk.write(helper::readfile(input_file, index, total));
+					} else {
+						unpack(chunk);
+					}
+					size_t c = chunk.read<size_t>(), rest = chunk.remain();
+					std::lock_guard<std::mutex> guard(lock);
+					if ( mapped_data.remain() == 0 ) {
+						mapped_data.clear();
+					}
+					memcpy(mapped_data.grow(rest), chunk.read(rest), rest);
+					count += c;
+					prof.records += c;
+					if ( c > 0 ) {
+						unread.push_back(c);
+					}
+					if ( speculate && c == 0 ) {
+						queue->done(index);
+					} else if ( speculate ) {
+						runs.emplace_back(new run_t(index, c, mapped_data.size(), n));
+					}
+				}
+			};
+
+			auto work = [&](size_t t) {
+				arg_cc_t batch;
+				pair_cc_t mid_cc_part, *pair_cc = new pair_cc_t[size];
+				size_t emitted = 0, held = 0;
+				buffer_t *buffer = buffers[t];
+				key_sampler<key_t> sampler(split_hot_keys() ? conf.skew_sample : 0, size);
+
+				pair_cc_t *into = pair_cc;
+				auto route = [&](pair_t &&pair) {
+					size_t home = home_of<map_t>(pair.first, size, has_partition<map_t>());
+					size_t target = sampler.target(pair.first, home);
+					if ( (pipe != nullptr || spills != nullptr) && into == pair_cc ) {
+						held += wire_size(pair);
+					}
+					into[target].push_back(std::move(pair));
+				};
+
+				while ( true ) {
+					if ( queue && t == 0 ) {
+						refill();
+					}
+					run_t *run = nullptr;
+					{
+						std::lock_guard<std::mutex> guard(lock);
+						while ( speculate && reading < runs.size() &&
+								(runs[reading]->unread == 0 || runs[reading]->stopped) ) {
+							run_t &skip = *runs[reading++];
+							if ( skip.unread > 0 ) {
+								mapped_data.read(skip.end - (mapped_data.size() - mapped_data.remain()));
+								count -= skip.unread;
+								read_off(skip.unread);
+								skip.unread = 0;
+							}
+						}
+						size_t one = std::min(count, (size_t)MAP_BATCH);
+						if ( speculate && reading < runs.size() ) {
+							run = runs[reading].get();
+							one = std::min(one, run->unread);
+							run->unread -= one;
+						}
+						for (size_t i = 0; i < one; ++i) {
+							batch.push_back(mapped_data.read<arg_t>());
+						}
+						count -= one;
+						if ( queue ) {
+							read_off(one);
+						}
+					}
+					if ( run != nullptr ) {
+						if ( run->outs[t] == nullptr ) {
+							run->outs[t] = new pair_cc_t[size];
+						}
+						into = run->outs[t];
+					}
+					if ( batch.empty() && !feeding ) {
+						break;
+					} else if ( batch.empty() ) {
+						if ( pipe != nullptr && t == 0 ) {
+							pipe->pump();
+						}
+						std::this_thread::sleep_for(std::chrono::microseconds(100));
+						continue;
+					}
+					for (arg_t &part : batch) {
+						if ( run != nullptr && run->stopped ) {
+							break;
+						}
+						mappers[t]->map(part, mid_cc_part);
+						emitted += mid_cc_part.size();
+						for (pair_t &pair : mid_cc_part) {
+							sampler.count(pair.first);
+							if ( buffer != nullptr ) {
+								buffer->insert(std::move(pair));
+							} else {
+								route(std::move(pair));
+							}
+						}
+						mid_cc_part.clear();
+
+						if ( buffer != nullptr && buffer->full() ) {
+							buffer->flush(route);
+						}
+						if ( pipe != nullptr && !speculate && held >= share ) {
+							if ( combiner != nullptr ) {
+								(this->*combiner)(pair_cc);
+							}
+							pipe->post(make_round(pair_cc), t == 0);
+							held = 0;
+						}
+						if ( spills != nullptr && held >= share ) {
+							if ( combiner != nullptr ) {
+								(this->*combiner)(pair_cc);
+							}
+							spill_buckets(pair_cc, spills->files[t], lock);
+							held = 0;
+						}
+					}
+					if ( run != nullptr && !run->stopped && (run->left -= batch.size()) == 0 ) {
+						std::lock_guard<std::mutex> guard(lock);
+						finished.push_back(run->index);
+					}
+					batch.clear();
+					if ( pipe != nullptr && t == 0 ) {
+						pipe->pump();
+					}
+				}
+				if ( buffer != nullptr ) {
+					buffer->flush(route);
+					delete buffer;
+				}
+				outs[t] = pair_cc;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					prof.pairs += emitted;
+				}
+				--running;
+			};
+
+			collection<std::thread> threads;
+			for (size_t t = 1; t < n; ++t) {
+				threads.emplace_back(work, t);
+			}
+			work(0);
+
+			// a worker's last list goes out once all its threads are done
+			bool last = false;
+			while ( true ) {
+				if ( queue && !last && running == 0 ) {
+					report();
+					queue->finish();
+					last = true;
+				}
+				bool mapping = pipe != nullptr && running > 0;
+				bool serving = queue && !(last && queue->closed());
+				if ( !mapping && !serving ) {
+					break;
+				}
+				if ( pipe != nullptr ) {
+					pipe->pump();
+				}
+				if ( queue ) {
+					queue->serve();
+				}
+				if ( speculate && running > 0 ) {
+					stop();
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+			for (std::thread &thread : threads) {
+				thread.join();
+			}
+			collection<int32_t> owners;
+			if ( speculate ) {
+				owners = queue->settle();
+			}
+			queue.reset();
+			if ( chunked ) {
+				mapped_data.clear();
+			} else {
+				mapped_data.reset();
+			}
 
-			size_t count = mapped_data.read<size_t>();
-			while ( count-- > 0 ) {
-				arg_t part = mapped_data.read<arg_t>();
-				mapper.map(part, mid_cc_part);
-				for (pair_t &pair : mid_cc_part) {
-					size_t target = (hfunc(pair.first) % size);
-					pair_cc[target].push_back(std::move(pair));
+			auto merge = [&](pair_cc_t *into, pair_cc_t *from) {
+				for (size_t k = 0; k < size; ++k) {
+					pair_cc_t &part = from[k];
+					std::move(part.begin(), part.end(), std::back_inserter(into[k]));
+				}
+				delete [] from;
+			};
+			pair_cc_t *pair_cc = outs[0];
+			for (size_t t = 1; t < n; ++t) {
+				merge(pair_cc, outs[t]);
+			}
+			for (std::unique_ptr<run_t> &run : runs) {
+				for (pair_cc_t *out : run->outs) {
+					if ( out != nullptr && owners[run->index] == mpi.id() ) {
+						merge(pair_cc, out);
+					} else {
+						delete [] out;
+					}
 				}
-				mid_cc_part.clear();
 			}
-			mapped_data.reset();
 			return pair_cc;
 		}
 
@@ -240,69 +1316,347 @@ namespace ares_impl {
 			typedef typename reduce_func::val_t val_t;
 			typedef typename reduce_func::ret_t ret_t;
 			typedef pair<key_t, val_t> pair_t;
-			typedef collection<val_t> val_cc_t;
 			typedef collection<ret_t> ret_cc_t;
 			typedef collection<pair_t> pair_cc_t;
 
-			reduce_t reducer;
-			setup<typename reduce_func::setup_t>(reducer, r_side_data, has_setup<reduce_t>());
+			// received pairs are read as what reduce takes; views point into
+			// the receive buffers, which live until reduce is over
+			typedef typename reduce_func::param_key_t in_key_t;
+			typedef typename reduce_func::param_val_t in_val_t;
+			typedef collection<pair<in_key_t, in_val_t>> in_cc_t;
+			typedef collection<in_val_t> in_val_cc_t;
+
+			std::shared_ptr<reduce_t> reducer = set_up<typename reduce_func::setup_t, reduce_t>(
+					r_side_data, has_setup<reduce_t>());
 
 			size_t size = mpi.size();
 			pair_cc_t *pair_cc = (pair_cc_t *)pair_cc_p;
+			if ( spills != nullptr ) {
+				return reduce_spilled<R>(*reducer, pair_cc);
+			}
 
-			byte_array send_data[size], recv_data[size];
-			for (size_t k = 0; k < size; ++k) {
-				send_data[k].write(pair_cc[k]);
-				pair_cc[k].clear();
+			byte_array recv_all, *recv_data = new byte_array[size];
+			if ( pipe != nullptr ) {
+				byte_array *round;
+				{
+					profiler::scope timing(prof, phase::serialize);
+					round = make_round(pair_cc);
+				}
+				{
+					profiler::scope timing(prof, phase::alltoall);
+					pipe->post(round, true);
+					pipe->finish();
+				}
+				std::swap(recv_data, pipe->recv);
+				for (size_t k = 0; k < size; ++k) {
+					prof.sent[k] += pipe->sent[k];
+					prof.received[k] += recv_data[k].size();
+					unpack(recv_data[k]);
+				}
+			} else {
+				exchange(pair_cc, recv_all, recv_data);
 			}
+			delete [] pair_cc;
 
-			mpi.alltoall(send_data, recv_data);
+			// pairs of hot keys spread here from another home are set apart
+			bool skew = split_hot_keys();
+			typedef std::function<size_t(const key_t &)> partition_t;
+			partition_t &home = *(partition_t *)partitioner.get();
+			arena *tables = conf.arena ? &pool : nullptr;
+			group_map<key_t, val_t> partial = make_group_map<key_t, val_t>(tables);
+
+			in_cc_t all;
+			group_map<in_key_t, in_val_t> middle_map = make_group_map<in_key_t, in_val_t>(tables);
+			auto feed = [&](byte_array recv[]) {
+				for (size_t k = 0; k < size; ++k) {
+					byte_array &x = recv[k];
+					while ( x.remain() > 0 ) {
+						in_cc_t pairs = x.read<in_cc_t>();
+						for (auto &p : pairs) {
+							// the partial results are combined and sent on,
+							// so views of them are copied
+							if ( skew && home(owned(p.first)) != (size_t)mpi.id() ) {
+								partial[owned(p.first)].push_back(owned(std::move(p.second)));
+							} else if ( conf.group == grouping::sort ) {
+								all.push_back(std::move(p));
+							} else {
+								middle_map[p.first].push_back(std::move(p.second));
+							}
+						}
+					}
+				}
+			};
+			{
+				profiler::scope timing(prof, phase::group);
+				feed(recv_data);
+			}
 
-			delete [] pair_cc;
+			byte_array fwd_all, fwd_data[size];
+			if ( skew ) {
+				// combine the partial results and send them to their home
+				typedef combiner_base<key_t, val_t> comb_t;
+				pair_cc_t *forward = new pair_cc_t[size];
+				{
+					profiler::scope timing(prof, phase::combine);
+					comb_t *comb = (comb_t *)(this->*combiner_factory)(nullptr);
+					for (auto &part : partial) {
+						forward[home(part.first)].push_back(comb->combine(part.first, part.second));
+					}
+					partial.clear();
+					delete comb;
+				}
+
+				exchange(forward, fwd_all, fwd_data);
+				delete [] forward;
+
+				profiler::scope timing(prof, phase::group);
+				feed(fwd_data);
+			}
+
+			// sort grouping happens while reducing and is timed with it
+			ret_cc_t ret_cc;
+			auto reduce = [&](const in_key_t &key, const in_val_cc_t &values) {
+				ret_cc.push_back(reducer->reduce(key, values));
+			};
+
+			{
+				profiler::scope timing(prof, phase::reduce);
+				if ( conf.group == grouping::sort ) {
+					group::sort_group(all, reduce);
+				} else {
+					for (auto &part : middle_map) {
+						reduce(part.first, part.second);
+					}
+				}
+			}
+			prof.results += ret_cc.size();
+
+			profiler::scope serialize(prof, phase::serialize);
+			byte_array *result = new byte_array();
+			result->write(ret_cc);
+			delete [] recv_data;
+
+			return result;
+		}
+
+		// writes every bucket to file as a run for its destination
+		template <typename P> void spill_buckets(collection<P> *pair_cc,
+				spill::file &file, std::mutex &lock) {
+			byte_array data;
+			for (size_t k = 0; k < mpi.size(); ++k) {
+				if ( !pair_cc[k].empty() ) {
+					spill::write_run(pair_cc[k], data, conf.compress);
+					spill::run run = spills->append(file, data);
+					data.clear();
+
+					std::lock_guard<std::mutex> guard(lock);
+					spills->runs[k].push_back(run);
+				}
+			}
+		}
+
+		/* do_reduce when spilling: what map kept in memory becomes the last
+		 * runs, every rank sends one run to each destination a round and
+		 * stores the runs it gets, and reduce is fed by a merge of them
+		 */
+		template <typename R> byte_array *reduce_spilled(typename reduce_func_type<R>::reduce_t &reducer,
+				collection<pair<typename reduce_func_type<R>::key_t,
+				typename reduce_func_type<R>::val_t>> *pair_cc) {
+			typedef reduce_func_type<R> reduce_func;
+			typedef typename reduce_func::key_t key_t;
+			typedef typename reduce_func::val_t val_t;
+			typedef collection<typename reduce_func::ret_t> ret_cc_t;
+
+			size_t size = mpi.size();
+			spills->files.emplace_back();
+			spill::file &file = spills->files.back();
+			{
+				profiler::scope timing(prof, phase::serialize);
+				std::mutex lock;
+				spill_buckets(pair_cc, file, lock);
+				delete [] pair_cc;
+			}
 
-			std::unordered_map<key_t, val_cc_t> middle_map;
+			size_t rounds = 0;
 			for (size_t k = 0; k < size; ++k) {
-				byte_array &x = recv_data[k];
-				pair_cc_t pairs = x.read<pair_cc_t>();
-				for (pair_t &p : pairs) {
-					middle_map[p.first].push_back(std::move(p.second));
+				rounds = std::max(rounds, spills->runs[k].size());
+			}
+			rounds = mpi.max(rounds);
+
+			collection<spill::run> received;
+			for (size_t r = 0; r < rounds; ++r) {
+				byte_array send_data, recv_all, recv_data[size];
+				collection<size_t> counts(size);
+				{
+					profiler::scope timing(prof, phase::serialize);
+					for (size_t k = 0; k < size; ++k) {
+						if ( r < spills->runs[k].size() ) {
+							const spill::run &run = spills->runs[k][r];
+							run.in->read(run.offset, run.bytes, send_data);
+							counts[k] = run.bytes;
+						}
+					}
+				}
+				{
+					profiler::scope timing(prof, phase::alltoall);
+					mpi.alltoall(send_data, counts.data(), recv_all, recv_data);
+				}
+				profiler::scope timing(prof, phase::group);
+				for (size_t k = 0; k < size; ++k) {
+					prof.sent[k] += counts[k];
+					prof.received[k] += recv_data[k].size();
+					if ( recv_data[k].size() > 0 ) {
+						received.push_back(spills->append(file, recv_data[k]));
+					}
 				}
 			}
 
 			ret_cc_t ret_cc;
-			for (auto &part : middle_map) {
-				ret_cc.push_back(reducer.reduce(part.first, part.second));
+			{
+				profiler::scope timing(prof, phase::reduce);
+				collection<typename reduce_func::param_val_t> params;
+				spill::merger<key_t, val_t> merge(mpi, received, conf.compress);
+				merge.each([&](const key_t &key, collection<val_t> &values) {
+					ret_cc.push_back(reducer.reduce(key, as_params(values, params)));
+				});
 			}
+			prof.results += ret_cc.size();
 
+			profiler::scope serialize(prof, phase::serialize);
 			byte_array *result = new byte_array();
 			result->write(ret_cc);
-
 			return result;
 		}
 
+		// a rank's serialized results and the part write_results makes of them
+		struct part_output {
+			byte_array *results;
+			result_format format;
+			result_part part;
+			bool ok;
+		};
+
+		template <typename R> void *write_results(void *out_p) {
+			typedef typename reduce_func_type<R>::ret_t ret_t;
+			part_output *out = (part_output *)out_p;
+			out->ok = write_part<ret_t>(*out->results, out->format, out->part);
+			return out;
+		}
+
+		// alltoall of the buckets, recv_data[k] views what rank k sent
+		template <typename P> void exchange(collection<P> *pair_cc,
+				byte_array &recv_all, byte_array recv_data[]) {
+			size_t size = mpi.size();
+			byte_array send_data;
+			collection<size_t> counts(size);
+			{
+				profiler::scope timing(prof, phase::serialize);
+				byte_array part;
+				for (size_t k = 0; k < size; ++k) {
+					size_t begin = send_data.size();
+					if ( conf.compress ) {
+						part.write(pair_cc[k]);
+						lz::encode(part.data(), part.size(), send_data, k == (size_t)mpi.id());
+						part.clear();
+					} else {
+						send_data.write(pair_cc[k]);
+					}
+					pair_cc[k].clear();
+					counts[k] = send_data.size() - begin;
+				}
+			}
+			if ( conf.node_shuffle ) {
+				profiler::scope timing(prof, phase::alltoall);
+				mpi.set_nodes(conf.ranks_per_node);
+				mpi.node_alltoall(send_data, counts.data(), recv_all, recv_data,
+						[this](collection<byte_array> &parts) { merge_node<P>(parts); });
+			} else {
+				profiler::scope timing(prof, phase::alltoall);
+				mpi.alltoall(send_data, counts.data(), recv_all, recv_data);
+			}
+			for (size_t k = 0; k < size; ++k) {
+				prof.sent[k] += counts[k];
+				prof.received[k] += recv_data[k].size();
+				unpack(recv_data[k]);
+			}
+		}
+
+		/* on a node leader, combines what the ranks of the node send each
+		 * rank, so that a key leaves the node once
+		 */
+		template <typename P> void merge_node(collection<byte_array> &parts) {
+			if ( combiner == nullptr ) {
+				return;
+			}
+			size_t size = mpi.size();
+			collection<P> *pair_cc = new collection<P>[size];
+			for (size_t k = 0; k < size; ++k) {
+				unpack(parts[k]);
+				while ( parts[k].remain() > 0 ) {
+					collection<P> pairs = parts[k].template read<collection<P>>();
+					std::move(pairs.begin(), pairs.end(), std::back_inserter(pair_cc[k]));
+				}
+				parts[k].clear();
+			}
+			(this->*combiner)(pair_cc);
+			for (size_t k = 0; k < size; ++k) {
+				parts[k].write(pair_cc[k]);
+				pack(parts[k], k == (size_t)mpi.id());
+			}
+			delete [] pair_cc;
+		}
+
+		// serializes and empties the buckets, one byte_array per target
+		template <typename P> byte_array *make_round(collection<P> *pair_cc) {
+			size_t size = mpi.size();
+			byte_array *round = new byte_array[size];
+			for (size_t k = 0; k < size; ++k) {
+				if ( !pair_cc[k].empty() ) {
+					round[k].write(pair_cc[k]);
+					pair_cc[k].clear();
+					pack(round[k], k == (size_t)mpi.id());
+				}
+			}
+			return round;
+		}
+
+		template <typename C> void *make_combiner(void *) {
+			typedef combine_func_type<C> combine_func;
+			typedef combiner_base<typename combine_func::key_t,
+					typename combine_func::val_t> base_t;
+
+			combiner_impl<C> *comb = new combiner_impl<C>();
+			comb->combiner = set_up<typename combine_func::setup_t, typename combine_func::combine_t>(
+					c_side_data, has_setup<typename combine_func::combine_t>());
+			return static_cast<base_t *>(comb);
+		}
+
 		template <typename C> void *do_combine(void *pair_cc_p) {
 			typedef combine_func_type<C> combine_func;
 			typedef typename combine_func::combine_t combine_t;
 			typedef typename combine_func::key_t key_t;
 			typedef typename combine_func::val_t val_t;
 			typedef typename combine_func::pair_t pair_t;
-			typedef collection<val_t> val_cc_t;
 			typedef collection<pair_t> pair_cc_t;
 
-			combine_t combiner;
-			setup<typename combine_func::setup_t>(combiner, c_side_data, has_setup<combine_t>());
+			std::shared_ptr<combine_t> combiner = set_up<typename combine_func::setup_t, combine_t>(
+					c_side_data, has_setup<combine_t>());
 
 			size_t size = mpi.size();
 			pair_cc_t *pair_cc = (pair_cc_t *)pair_cc_p;
 
+			// this may run on any map thread, so it has an arena of its own
+			arena local;
 			for (size_t k = 0; k < size; k++) {
-				std::unordered_map<key_t, val_cc_t> result_map;
+				group_map<key_t, val_t> result_map =
+						make_group_map<key_t, val_t>(conf.arena ? &local : nullptr);
 				for (pair_t &pair : pair_cc[k]) {
 					result_map[pair.first].push_back(std::move(pair.second));
 				}
 				pair_cc_t result;
+				collection<typename combine_func::param_val_t> params;
 				for (auto &pair : result_map) {
-					result.push_back(combiner.combine(pair.first, pair.second));
+					result.push_back(combiner->combine(pair.first, as_params(pair.second, params)));
 				}
 				pair_cc[k].swap(result);
 			}
@@ -313,10 +1667,12 @@ namespace ares_impl {
 	namespace work_flow_api {
 
 		template <typename ... Ts> static void initialize() {
-			MPI_Init(nullptr, nullptr);
+			int provided;
+			MPI_Init_thread(nullptr, nullptr, MPI_THREAD_SERIALIZED, &provided);
 
 			work_flow *wf = new work_flow();
 			work_flow::instance() = wf;
+			wf->serialized = provided >= MPI_THREAD_SERIALIZED;
 			wf->hlist.push_back(nullptr);
 			wf->register_type((Ts *)nullptr...);
 
@@ -331,27 +1687,54 @@ namespace ares_impl {
 		}
 
 		template <typename T> static void scatter_map_data(const collection<T> &arg_cc) {
-			work_flow::instance()->scatter(arg_cc);
+			work_flow::ready()->scatter(arg_cc);
+		}
+
+		// the map input becomes the lines of a file every rank can open
+		inline void scatter_map_file(const std::string &name) {
+			work_flow::ready()->scatter_file(name);
 		}
 
 		template <typename T> static void set_map_side_data(const T &data) {
-			work_flow *wf = work_flow::instance();
+			work_flow *wf = work_flow::ready();
 			wf->set_side_data(data, wf->m_side_data, opt_code::m_side_data);
 		}
 
 		template <typename T> static void set_reduce_side_data(const T &data) {
-			work_flow *wf = work_flow::instance();
+			work_flow *wf = work_flow::ready();
 			wf->set_side_data(data, wf->r_side_data, opt_code::r_side_data);
 		}
 
 		template <typename T> static void set_combine_side_data(const T &data) {
-			work_flow *wf = work_flow::instance();
+			work_flow *wf = work_flow::ready();
 			wf->set_side_data(data, wf->c_side_data, opt_code::c_side_data);
 		}
 
+		inline const config &get_config() {
+			return work_flow::ready()->conf;
+		}
+
+		inline void set_config(const config &conf) {
+			work_flow::ready()->set_config(conf);
+		}
+
+		// file the master appends job profiles to when config::profile is set
+		inline void set_profile_output(const std::string &path) {
+			work_flow::ready()->profile_path = path;
+		}
+
 		template <typename M, typename R = M, typename C = R>
 		static typename job<M, R, C>::ret_cc_t run_without_scatter() {
-			return work_flow::instance()->do_run<M, R, C>();
+			return work_flow::ready()->do_run<M, R, C>();
+		}
+
+		/* runs the job up to n times or until converged(prev, curr) is true,
+		 * feeding every round's results to the map setup of the next one
+		 * without a trip through the master; returns the last results
+		 */
+		template <typename M, typename R = M, typename C = R, typename F>
+		static typename job<M, R, C>::ret_cc_t iterate(size_t n, F &&converged) {
+			return work_flow::ready()->do_iterate<M, R, C>(n, std::forward<F>(converged));
 		}
 
 		template <typename M, typename R = M, typename C = R>
@@ -359,6 +1742,76 @@ namespace ares_impl {
 			scatter_map_data(arg_cc);
 			return run_without_scatter<M, R, C>();
 		}
+
+		/* run_job without waiting for it: jobs submitted run in order, one
+		 * at a time, while the caller goes on; any other call first waits
+		 * for them. the future holds the results
+		 */
+		template <typename M, typename R = M, typename C = R>
+		static std::future<typename job<M, R, C>::ret_cc_t> submit_job(typename job<M, R, C>::arg_cc_t arg_cc) {
+			typedef typename job<M, R, C>::arg_cc_t arg_cc_t;
+			typedef typename job<M, R, C>::ret_cc_t ret_cc_t;
+			work_flow *wf = work_flow::instance();
+			auto data = std::make_shared<arg_cc_t>(std::move(arg_cc));
+			return wf->submit<ret_cc_t>([wf, data] {
+				wf->scatter(*data);
+				return wf->do_run<M, R, C>();
+			});
+		}
+
+		// run_without_scatter without waiting for it, see submit_job
+		template <typename M, typename R = M, typename C = R>
+		static std::future<typename job<M, R, C>::ret_cc_t> submit_without_scatter() {
+			typedef typename job<M, R, C>::ret_cc_t ret_cc_t;
+			work_flow *wf = work_flow::instance();
+			return wf->submit<ret_cc_t>([wf] {
+				return wf->do_run<M, R, C>();
+			});
+		}
+
+		/* runs the job, leaving each rank's results on it; walking the
+		 * stream fetches them from one rank at a time and reads them one at
+		 * a time, so the master holds a single part. what is not walked is
+		 * dropped with the stream
+		 */
+		template <typename M, typename R = M, typename C = R>
+		static result_stream<typename job<M, R, C>::ret_t> run_to_stream() {
+			return work_flow::ready()->do_stream<M, R, C>();
+		}
+
+		/* runs the job with every rank writing its results to prefix.part-N
+		 * itself, as the serialized collection or as text, and the master
+		 * writing the manifest, prefix.manifest, a line of path, count,
+		 * bytes and format per part. result_stream reads back binary parts
+		 */
+		template <typename M, typename R = M, typename C = R>
+		static result_manifest run_to_files(const std::string &prefix,
+				result_format format = result_format::binary) {
+			return work_flow::ready()->do_write<M, R, C>(prefix, format);
+		}
+
+		/* runs the job on the current map input and leaves each rank's
+		 * results on it as dataset name (replacing one of that name), for
+		 * a later stage to map; returns how many results there are
+		 */
+		template <typename M, typename R = M, typename C = R>
+		static size_t run_to_dataset(const std::string &name) {
+			return work_flow::ready()->do_keep<M, R, C>(name);
+		}
+
+		// the map input becomes dataset name, read where it lies
+		inline void map_dataset(const std::string &name) {
+			work_flow::ready()->do_dataset(opt_code::map_dataset, name);
+		}
+
+		// every element of dataset name, collected on the master
+		template <typename T> static collection<T> gather_dataset(const std::string &name) {
+			return work_flow::ready()->do_gather<T>(name);
+		}
+
+		inline void drop_dataset(const std::string &name) {
+			work_flow::ready()->do_dataset(opt_code::drop_dataset, name);
+		}
 	}
 }
 